@@ -0,0 +1,249 @@
+#include <math.h>
+#include <stdint.h>
+#include<stdio.h>
+#include<stdlib.h>
+
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+
+// Runs for every print, so it's optimized even in -O0 builds.
+#pragma GCC push_options
+#pragma GCC optimize("O2")
+
+#define INN_OUT_SIZE (1 << 16)
+
+// Output is collected in a buffer per thread and handed to stdout in large
+// writes. Buffers are kept in a list so that all of them are flushed at exit.
+typedef struct inn_out_buf {
+  struct inn_out_buf *next;
+  size_t len;
+  char data[INN_OUT_SIZE];
+} inn_out_buf;
+
+static inn_out_buf *_Atomic inn_out_all;
+static _Thread_local inn_out_buf *inn_out;
+static atomic_flag inn_out_lock = ATOMIC_FLAG_INIT;
+static int inn_out_tty; // Terminals get each print as soon as it's done
+
+static void inn_out_write(const char *p, size_t n) {
+  while (atomic_flag_test_and_set_explicit(&inn_out_lock, memory_order_acquire))
+    ;
+  fwrite(p, 1, n, stdout);
+  atomic_flag_clear_explicit(&inn_out_lock, memory_order_release);
+}
+
+static void inn_out_flush_buf(inn_out_buf *b) {
+  inn_out_write(b->data, b->len);
+  b->len = 0;
+}
+
+static void inn_out_exit(void) {
+  for (inn_out_buf *b = atomic_load(&inn_out_all); b; b = b->next)
+    if (b->len)
+      inn_out_flush_buf(b);
+}
+
+static inn_out_buf *inn_out_new(void) {
+  inn_out_buf *b = malloc(sizeof(*b));
+  if (!b) {
+    fprintf(stderr, "inn: print out of memory\n");
+    abort();
+  }
+  b->len = 0;
+  b->next = atomic_load(&inn_out_all);
+  while (!atomic_compare_exchange_weak(&inn_out_all, &b->next, b))
+    ;
+  if (!b->next) {
+    inn_out_tty = isatty(1);
+    atexit(inn_out_exit);
+  }
+  return inn_out = b;
+}
+
+// Room for `n` more bytes in this thread's buffer, which n has to fit.
+static inline char *inn_out_reserve(size_t n) {
+  inn_out_buf *b = inn_out ? inn_out : inn_out_new();
+  if (INN_OUT_SIZE - b->len < n)
+    inn_out_flush_buf(b);
+  char *p = b->data + b->len;
+  b->len += n;
+  return p;
+}
+
+static inline int inn_out_bytes(const char *p, long long n) {
+  if (n > INN_OUT_SIZE / 2) {
+    inn_out_flush_buf(inn_out ? inn_out : inn_out_new());
+    inn_out_write(p, n);
+  } else {
+    memcpy(inn_out_reserve(n), p, n);
+  }
+  return (int)n;
+}
+
+static inline int inn_out_cstr(const char *s) {
+  return inn_out_bytes(s, strlen(s));
+}
+
+static inline int inn_out_char(int c) {
+  *inn_out_reserve(1) = (char)c;
+  return 1;
+}
+
+static inline int inn_out_int(long long v) {
+  char tmp[24], *end = tmp + sizeof(tmp), *p = end;
+  unsigned long long u = v < 0 ? 0ull - (unsigned long long)v : v;
+  do {
+    *--p = '0' + u % 10;
+    u /= 10;
+  } while (u);
+  if (v < 0)
+    *--p = '-';
+  return inn_out_bytes(p, end - p);
+}
+
+static inline int inn_out_uint(unsigned long long u) {
+  char tmp[24], *end = tmp + sizeof(tmp), *p = end;
+  do {
+    *--p = '0' + u % 10;
+    u /= 10;
+  } while (u);
+  return inn_out_bytes(p, end - p);
+}
+
+static int inn_out_float_slow(double x, int prec) {
+  char tmp[400];
+  int n = snprintf(tmp, sizeof(tmp), "%.*f", prec, x);
+  return inn_out_bytes(tmp, n < (int)sizeof(tmp) ? n : (int)sizeof(tmp) - 1);
+}
+
+// Same digits as printf's %.*f. The fraction of a double of at least 2^-11
+// is a whole number of 2^-64ths, so it's scaled and rounded half to even
+// exactly in 128-bit integers. Anything else goes to snprintf.
+static int inn_out_float(double x, int prec) {
+#ifdef __SIZEOF_INT128__
+  static const unsigned long long pow10[] = {
+      1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+      1000000000};
+  double a = fabs(x);
+  if (!(a < 1e15) || (a != 0 && a < 0x1p-11) || prec < 0 || prec > 9)
+    return inn_out_float_slow(x, prec);
+  unsigned long long ip = (unsigned long long)a;
+  unsigned __int128 t =
+      (unsigned __int128)(unsigned long long)ldexp(a - ip, 64) * pow10[prec];
+  unsigned long long q = (unsigned long long)(t >> 64), r = (unsigned long long)t;
+  // Ties go to an even last digit, which is in `ip` for %.0f.
+  if (r > 1ull << 63 || (r == 1ull << 63 && ((prec ? q : ip) & 1)))
+    q++;
+  if (q >= pow10[prec]) {
+    q -= pow10[prec];
+    ip++;
+  }
+  char tmp[32], *p = tmp + sizeof(tmp);
+  for (int i = 0; i < prec; ++i, q /= 10)
+    *--p = '0' + q % 10;
+  if (prec > 0)
+    *--p = '.';
+  do {
+    *--p = '0' + ip % 10;
+    ip /= 10;
+  } while (ip);
+  if (signbit(x))
+    *--p = '-';
+  return inn_out_bytes(p, tmp + sizeof(tmp) - p);
+#else
+  return inn_out_float_slow(x, prec);
+#endif
+}
+
+// Called before stdio writes to stdout, which would otherwise overtake
+// buffered prints.
+static inline void inn_out_sync(void) {
+  if (inn_out && inn_out->len)
+    inn_out_flush_buf(inn_out);
+}
+
+// End of one print.
+static inline int inn_out_done(int n) {
+  if (inn_out_tty)
+    inn_out_sync();
+  return n;
+}
+
+static void inn_flush(void) {
+  inn_out_sync();
+  fflush(stdout);
+}
+
+#pragma GCC pop_options
+typedef struct {
+int __inn_state;
+int lo;
+int hi;
+int i_0;
+} inn_gen_range;
+static int inn_gen_range_next(inn_gen_range *__inn_g, int *__inn_out);
+typedef struct {
+int __inn_state;
+int n;
+inn_gen_range __inn_gen0;
+int i_1;
+} inn_gen_evens;
+static int inn_gen_evens_next(inn_gen_evens *__inn_g, int *__inn_out);
+int  main();
+static int inn_gen_range_next(inn_gen_range *__inn_g, int *__inn_out) {
+switch (__inn_g->__inn_state) {
+case 0:
+break;
+case 1:
+goto __inn_resume1;
+default:
+return 0;
+}
+__inn_g->i_0 = __inn_g->lo;
+while ((__inn_g->i_0<__inn_g->hi)) {
+*__inn_out = __inn_g->i_0;
+__inn_g->__inn_state = 1;
+return 1;
+__inn_resume1:;
+(__inn_g->i_0=(__inn_g->i_0+1));
+}
+__inn_g->__inn_state = -1;
+return 0;
+}
+static int inn_gen_evens_next(inn_gen_evens *__inn_g, int *__inn_out) {
+switch (__inn_g->__inn_state) {
+case 0:
+break;
+case 1:
+goto __inn_resume1;
+default:
+return 0;
+}
+{
+__inn_g->__inn_gen0 = (inn_gen_range){.__inn_state = 0, .lo = 0, .hi = __inn_g->n};
+while (inn_gen_range_next(&__inn_g->__inn_gen0, &__inn_g->i_1)) {
+if ((((__inn_g->i_1/2)*2)==__inn_g->i_1)) {
+*__inn_out = __inn_g->i_1;
+__inn_g->__inn_state = 1;
+return 1;
+__inn_resume1:;
+}
+}
+}
+__inn_g->__inn_state = -1;
+return 0;
+}
+int  main() {
+{
+inn_gen_evens __inn_gen4 = (inn_gen_evens){.__inn_state = 0, .n = 10};
+int x;
+while (inn_gen_evens_next(&__inn_gen4, &x)) {
+({int __inn_n = 0;
+__auto_type __inn_p0 = x;
+__inn_n += inn_out_int(__inn_p0);
+__inn_n += inn_out_bytes("\n", 1);
+inn_out_done(__inn_n);});
+}
+}
+return 0;}
@@ -0,0 +1,22 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <unordered_map>
+int main(int argc, char **argv) {
+  int n = atoi(argv[1]), lookups = atoi(argv[2]);
+  std::unordered_map<uint64_t, int> m;
+  uint64_t x = 1;
+  for (int i = 0; i < n; ++i) {
+    x = x * 6364136223846793005ull + 1442695040888963407ull;
+    m[x >> 32] = i;
+  }
+  int sum = 0;
+  for (int i = 0, j = 0; i < lookups; ++i, ++j) {
+    if (j == n) { j = 0; x = 1; }
+    x = x * 6364136223846793005ull + 1442695040888963407ull;
+    uint64_t k = x >> 32;
+    auto a = m.find(k), b = m.find(k + 1);
+    sum += (a != m.end() ? a->second : 0) + (b != m.end() ? b->second : 0);
+  }
+  printf("%zu %d\n", m.size(), sum);
+}
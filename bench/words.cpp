@@ -0,0 +1,23 @@
+#include <fcntl.h>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+int main(int argc, char **argv) {
+  int fd = open(argv[1], O_RDONLY);
+  struct stat st;
+  fstat(fd, &st);
+  const char *p = (const char *)mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  std::unordered_map<std::string_view, int> counts;
+  for (size_t at = 0; at < (size_t)st.st_size;) {
+    const char *nl = (const char *)memchr(p + at, '\n', st.st_size - at);
+    size_t n = nl ? nl - (p + at) : st.st_size - at;
+    counts[std::string_view(p + at, n)]++;
+    at += n + 1;
+  }
+  int most = 0;
+  for (auto &[w, c] : counts) most = c > most ? c : most;
+  printf("%zu %d\n", counts.size(), most);
+}
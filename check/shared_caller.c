@@ -0,0 +1,14 @@
+#include "libshared.h"
+#include <stdio.h>
+
+int main(void) {
+  vec3 a = {1, 2, 3}, b = {4, 5, 6};
+  printf("%g\n", dot3(a, b));
+  float xs[8];
+  for (int i = 0; i < 8; ++i)
+    xs[i] = i;
+  scale(xs, 8, 0.5f);
+  printf("%g %g\n", xs[7], total(xs, 8));
+  printf("%lld\n", (long long)triangle(100000));
+  return 0;
+}
@@ -1,4 +1,6 @@
 #include "ast.hpp"
+#include <charconv>
+#include <cstdlib>
 #include <iostream>
 #include <unordered_map>
 #include <unordered_set>
@@ -10,7 +12,22 @@ std::unordered_map<Operator, int> precedences{
     {Operator::Less, 50},  {Operator::LessEq, 50},  {Operator::And, 30},
     {Operator::Or, 20},    {Operator::Not, 100},    {Operator::Pos, 90},
     {Operator::Neg, 90},   {Operator::Index, 110},  {Operator::FuncCall, 110},
-    {Operator::Ref, 100}};
+    {Operator::Ref, 100},  {Operator::Member, 110}, {Operator::Spawn, 100}};
+
+std::unordered_map<std::string, NumericType> numeric_types{
+    {"int", {32, false, true}},  {"i8", {8, false, true}},
+    {"i16", {16, false, true}},  {"i64", {64, false, true}},
+    {"u8", {8, false, false}},   {"u16", {16, false, false}},
+    {"u32", {32, false, false}}, {"u64", {64, false, false}},
+    {"float", {32, true, true}}, {"f64", {64, true, true}}};
+
+std::string canonical_type(const std::string &name) {
+  if (name == "i32")
+    return "int";
+  if (name == "f32")
+    return "float";
+  return name;
+}
 
 std::unordered_map<TokenType, Operator> infix_ops{
     {TokenType::Plus, Operator::Add},
@@ -32,11 +49,13 @@ std::unordered_map<TokenType, Operator> prefix_ops{
     {TokenType::Plus, Operator::Pos},
     {TokenType::Minus, Operator::Neg},
     {TokenType::KwNot, Operator::Not},
-    {TokenType::Ampersand, Operator::Ref}};
+    {TokenType::Ampersand, Operator::Ref},
+    {TokenType::KwSpawn, Operator::Spawn}};
 
 std::unordered_map<TokenType, Operator> suffix_ops{
     {TokenType::SquareOpen, Operator::Index},
     {TokenType::ParenOpen, Operator::FuncCall},
+    {TokenType::Dot, Operator::Member},
 };
 
 void ASTBuilder::trim_comments() {
@@ -74,9 +93,8 @@ std::optional<ASTSingular> ASTBuilder::parse_singular() {
   case TokenType::String:
     return ASTString{tokens[i++].lexeme};
   case TokenType::Int:
-    return ASTInt{std::stoi(tokens[i++].lexeme)};
   case TokenType::Float:
-    return ASTFloat{std::stof(tokens[i++].lexeme)};
+    return parse_number();
   case TokenType::Symbol:
     return ASTSymbol{tokens[i++].lexeme};
   default:
@@ -84,6 +102,40 @@ std::optional<ASTSingular> ASTBuilder::parse_singular() {
   }
 }
 
+// Literals without a suffix are int, or i64 if they don't fit, and float.
+ASTSingular ASTBuilder::parse_number() {
+  auto &tok = tokens[i++];
+  std::string digits = tok.lexeme, type{};
+  size_t suffix = digits.find_first_of("iuf");
+  if (suffix != std::string::npos) {
+    type = canonical_type(digits.substr(suffix));
+    digits.resize(suffix);
+    if (!numeric_types.contains(type))
+      throw ASTError(tok.loc, "Unknown literal suffix " +
+                                  tok.lexeme.substr(suffix) + ".");
+  }
+  if (tok.type == TokenType::Float) {
+    if (!type.empty() && !numeric_types[type].is_float)
+      throw ASTError(tok.loc, "Literal with a fraction can't be " + type + ".");
+    return ASTFloat{std::strtod(digits.c_str(), nullptr),
+                    type.empty() ? "float" : type};
+  }
+  uint64_t value = 0;
+  auto res = std::from_chars(digits.data(), digits.data() + digits.size(),
+                             value);
+  if (res.ec != std::errc{})
+    throw ASTError(tok.loc, "Integer literal is too large.");
+  if (type.empty())
+    type = value <= INT32_MAX ? "int" : "i64";
+  auto &num = numeric_types[type];
+  uint64_t max = num.bits == 64 ? UINT64_MAX : (1ull << num.bits) - 1;
+  if (num.is_signed)
+    max >>= 1;
+  if (value > max)
+    throw ASTError(tok.loc, "Literal doesn't fit in " + type + ".");
+  return ASTInt{value, type};
+}
+
 std::unordered_set<TokenType> stoppers{
     TokenType::ParenClose, TokenType::SquareClose, TokenType::Comma,
     TokenType::KwEnd,      TokenType::KwDo,        TokenType::KwElse};
@@ -127,6 +179,11 @@ std::optional<Expr> ASTBuilder::right(Operator op, Expr left) {
     return std::optional<Expr>(
         ASTOperation{Operator::Index, std::make_unique<Expr>(std::move(left)),
                      std::make_unique<Expr>(std::move(opt.value()))});
+  } else if (op == Operator::Member) {
+    expect(TokenType::Symbol, "Expected field name.");
+    return std::optional<Expr>(ASTOperation{
+        Operator::Member, std::make_unique<Expr>(std::move(left)),
+        std::make_unique<Expr>(Expr{ASTSymbol{tokens[i - 1].lexeme}})});
   } else if (op == Operator::FuncCall) {
     std::vector<Expr> args{};
     if (!accept(TokenType::ParenClose)) {
@@ -169,11 +226,13 @@ std::optional<Expr> ASTBuilder::left() {
     return std::optional<Expr>(ASTArray{std::move(args)});
   }
   if (accept(TokenType::ParenOpen)) {
-    return parse_expression();
+    auto opt = parse_expression();
+    expect(TokenType::ParenClose, "Expected closing parenthesis.");
+    return opt;
   }
   auto sing = parse_singular();
   if (sing.has_value())
-    return std::optional<Expr>({sing.value()}); // {{ ... }} yikes
+    return std::optional<Expr>(Expr{sing.value()});
   if (!prefix_ops.contains(tokens[i].type)) {
     return std::nullopt;
   }
@@ -185,32 +244,65 @@ std::optional<Expr> ASTBuilder::left() {
       op, nullptr, std::make_unique<Expr>(std::move(right.value()))});
 }
 
+// Name of the type of array elements, which can't be arrays themselves.
+std::string ASTBuilder::parse_element_type() {
+  if (!peek(TokenType::Symbol))
+    expect(TokenType::Symbol, "Expected typename.");
+  return parse_type()->name;
+}
+
 std::optional<ASTType> ASTBuilder::parse_type() {
+  if (accept(TokenType::KwSoa)) {
+    auto opt = parse_type();
+    expect_value(opt, "Expected array type after soa.");
+    if (opt->count <= 0)
+      throw ASTError(tokens[i - 1].loc, "soa needs a fixed size array type.");
+    opt->soa = true;
+    return opt;
+  }
   if (accept(TokenType::SquareOpen)) {
-    if (accept(TokenType::SquareClose)) {
-      expect(TokenType::Symbol, "Expected typename.");
-      std::string type = tokens[i - 1].lexeme;
-      return ASTType{type, -1};
-    }
+    if (accept(TokenType::SquareClose))
+      return ASTType{parse_element_type(), -1};
     expect(TokenType::Int, "Expected positive integer array size.");
-    int arr_size = std::stoi(tokens[i - 1].lexeme);
-    if (arr_size <= 0)
-      throw ASTError(tokens[i].loc, "Expected positive integer array size.");
+    auto &size = tokens[i - 1].lexeme;
+    int arr_size = 0;
+    auto res = std::from_chars(size.data(), size.data() + size.size(), arr_size);
+    if (res.ec != std::errc{} || res.ptr != size.data() + size.size() ||
+        arr_size <= 0)
+      throw ASTError(tokens[i - 1].loc, "Expected positive integer array size.");
     expect(TokenType::SquareClose, "Expected closing bracket.");
-    expect(TokenType::Symbol, "Expected typename.");
-    std::string type = tokens[i - 1].lexeme;
-    return ASTType{type, arr_size};
+    return ASTType{parse_element_type(), arr_size};
   }
   if (accept(TokenType::Symbol)) {
-    std::string type = tokens[i - 1].lexeme;
+    std::string type = canonical_type(tokens[i - 1].lexeme);
+    // Task handles name the type their function returns, task[int].
+    if (type == "task" && accept(TokenType::SquareOpen)) {
+      expect(TokenType::Symbol, "Expected typename.");
+      type += "[" + canonical_type(tokens[i - 1].lexeme) + "]";
+      expect(TokenType::SquareClose, "Expected closing bracket.");
+    }
+    // Maps name their key type in brackets and then their value type.
+    if (type == "map" && accept(TokenType::SquareOpen)) {
+      expect(TokenType::Symbol, "Expected key type.");
+      type += "[" + canonical_type(tokens[i - 1].lexeme) + "]";
+      expect(TokenType::SquareClose, "Expected closing bracket.");
+      expect(TokenType::Symbol, "Expected value type.");
+      type += canonical_type(tokens[i - 1].lexeme);
+    }
     return ASTType{type, 0};
   }
   return std::nullopt;
 }
 
 std::optional<ASTVarDeclare> ASTBuilder::parse_vardecl() {
-  if (!accept(TokenType::KwVar))
+  bool is_const = false;
+  if (i + 1 < tokens.size() && tokens[i].type == TokenType::KwConst &&
+      tokens[i + 1].type == TokenType::Symbol) {
+    is_const = true;
+    ++i;
+  } else if (!accept(TokenType::KwVar)) {
     return std::nullopt;
+  }
   expect(TokenType::Symbol, "Expected variable name.");
   std::string name = tokens[i - 1].lexeme;
   auto opt = parse_type();
@@ -219,17 +311,50 @@ std::optional<ASTVarDeclare> ASTBuilder::parse_vardecl() {
   if (accept(TokenType::Equal)) {
     auto opt = parse_expression();
     expect_value(opt, "Invalid expression on RHS.");
-    return ASTVarDeclare{name, std::move(type), std::move(opt.value())};
+    return ASTVarDeclare{name, std::move(type), std::move(opt.value()),
+                         is_const};
+  } else if (is_const) {
+    throw ASTError(tokens[i - 1].loc, "Constants need a value.");
   } else {
     return ASTVarDeclare{name, std::move(type), std::nullopt};
   }
 }
 
 std::optional<ASTFuncDeclare> ASTBuilder::parse_funcdecl() {
+  bool is_const = i + 1 < tokens.size() &&
+                  tokens[i].type == TokenType::KwConst &&
+                  tokens[i + 1].type == TokenType::KwFunc;
+  bool is_gen = i + 1 < tokens.size() && tokens[i].type == TokenType::KwGen &&
+                tokens[i + 1].type == TokenType::KwFunc;
+  if (is_const || is_gen)
+    ++i;
+  bool is_memo = accept(TokenType::KwMemo);
+  long long memo_bound = 0;
+  if (is_memo && accept(TokenType::ParenOpen)) {
+    expect(TokenType::Int, "Expected cache size.");
+    auto &size = tokens[i - 1].lexeme;
+    auto res = std::from_chars(size.data(), size.data() + size.size(),
+                               memo_bound);
+    if (res.ec != std::errc{} || res.ptr != size.data() + size.size() ||
+        memo_bound <= 0)
+      throw ASTError(tokens[i - 1].loc, "Expected positive cache size.");
+    expect(TokenType::ParenClose, "Expected closing parenthesis.");
+  }
+  if (is_memo && !peek(TokenType::KwFunc))
+    throw ASTError(tokens[i - 1].loc, "Expected 'func' after memo.");
   if (!accept(TokenType::KwFunc))
     return std::nullopt;
+  Position pos = tokens[i - 1].loc;
   expect(TokenType::Symbol, "Expected function name.");
   std::string name = tokens[i - 1].lexeme;
+  std::vector<std::string> type_params{};
+  if (accept(TokenType::SquareOpen)) {
+    do {
+      expect(TokenType::Symbol, "Expected type parameter.");
+      type_params.push_back(tokens[i - 1].lexeme);
+    } while (accept(TokenType::Comma));
+    expect(TokenType::SquareClose, "Expected closing bracket.");
+  }
   expect(TokenType::ParenOpen, "Expected params list.");
   std::vector<std::pair<std::string, ASTType>> args{};
   if (!accept(TokenType::ParenClose)) {
@@ -256,12 +381,42 @@ std::optional<ASTFuncDeclare> ASTBuilder::parse_funcdecl() {
     body.push_back(std::move(opt.value()));
   }
   expect(TokenType::KwEnd, "Expected block close.");
-  return ASTFuncDeclare{name, ret, std::move(args), std::move(body)};
+  return ASTFuncDeclare{name,
+                        ret,
+                        std::move(args),
+                        std::move(body),
+                        pos,
+                        is_const,
+                        std::move(type_params),
+                        is_gen,
+                        is_memo,
+                        memo_bound};
+}
+
+std::optional<ASTStructDeclare> ASTBuilder::parse_structdecl() {
+  if (!accept(TokenType::KwStruct))
+    return std::nullopt;
+  Position pos = tokens[i - 1].loc;
+  expect(TokenType::Symbol, "Expected struct name.");
+  std::string name = tokens[i - 1].lexeme;
+  expect(TokenType::KwDo, "Expected 'do'.");
+  std::vector<std::pair<std::string, ASTType>> fields{};
+  while (!accept(TokenType::KwEnd)) {
+    expect(TokenType::Symbol, "Expected field name.");
+    std::string field = tokens[i - 1].lexeme;
+    auto opt = parse_type();
+    expect_value(opt, "Expected field type.");
+    if (opt->soa)
+      throw ASTError(tokens[i - 1].loc, "soa arrays can't be struct fields.");
+    fields.push_back({field, opt.value()});
+  }
+  return ASTStructDeclare{name, std::move(fields), pos};
 }
 
 std::optional<ASTWhile> ASTBuilder::parse_while() {
   if (!accept(TokenType::KwWhile))
     return std::nullopt;
+  Position pos = tokens[i - 1].loc;
   auto opt = parse_expression();
   expect_value(opt, "Expected condition.");
   Expr cond = std::move(opt.value());
@@ -274,12 +429,13 @@ std::optional<ASTWhile> ASTBuilder::parse_while() {
       body.push_back(std::move(opt.value()));
     } while (!accept(TokenType::KwEnd));
   }
-  return ASTWhile{std::move(cond), std::move(body)};
+  return ASTWhile{std::move(cond), std::move(body), pos};
 }
 
 std::optional<ASTIf> ASTBuilder::parse_if() {
   if (!accept(TokenType::KwIf))
     return std::nullopt;
+  Position pos = tokens[i - 1].loc;
 
   auto optCond = parse_expression();
   expect_value(optCond, "Expected condition.");
@@ -326,27 +482,34 @@ std::optional<ASTIf> ASTBuilder::parse_if() {
 
   expect(TokenType::KwEnd, "Expected end to close if.");
 
-  return ASTIf{std::move(branches), std::move(elseBody)};
+  return ASTIf{std::move(branches), std::move(elseBody), pos};
 }
 
 std::optional<Statement> ASTBuilder::parse_statement() {
+  Position pos = i < tokens.size() ? tokens[i].loc : Position{0};
   if (auto opt = parse_vardecl(); opt.has_value()) {
-    return Statement{std::move(opt.value())};
+    return Statement{std::move(opt.value()), pos};
   }
   if (auto opt = parse_while(); opt.has_value()) {
-    return Statement{std::move(opt.value())};
+    return Statement{std::move(opt.value()), pos};
   }
   if (auto opt = parse_if(); opt.has_value()) {
-    return Statement{std::move(opt.value())};
+    return Statement{std::move(opt.value()), pos};
   }
   if (auto opt = parse_break(); opt.has_value()) {
-    return Statement{std::move(opt.value())};
+    return Statement{std::move(opt.value()), pos};
   }
   if (auto opt = parse_return(); opt.has_value()) {
-    return Statement{std::move(opt.value())};
+    return Statement{std::move(opt.value()), pos};
+  }
+  if (auto opt = parse_yield(); opt.has_value()) {
+    return Statement{std::move(opt.value()), pos};
+  }
+  if (auto opt = parse_for(); opt.has_value()) {
+    return Statement{std::move(opt.value()), pos};
   }
   if (auto opt = parse_expression(); opt.has_value()) {
-    return Statement{std::move(opt.value())};
+    return Statement{std::move(opt.value()), pos};
   }
   return std::nullopt;
 }
@@ -357,8 +520,12 @@ void ASTBuilder::parse() {
       roots.push_back(std::move(opt.value()));
       continue;
     }
+    if (auto opt = parse_structdecl(); opt.has_value()) {
+      roots.push_back(std::move(opt.value()));
+      continue;
+    }
     if (auto opt = parse_statement(); opt.has_value()) {
-      roots.push_back(Statement{std::move(opt.value())});
+      roots.push_back(std::move(opt.value()));
       continue;
     }
   }
@@ -418,6 +585,8 @@ void debug_print(Expr &ex) {
 }
 
 void debug_print(ASTType &type) {
+  if (type.soa)
+    std::cout << "soa ";
   std::cout << "[" << type.count << "]" << type.name;
 }
 
@@ -446,7 +615,7 @@ void debug_print(ASTIf &stm) {
 }
 
 void debug_print(ASTVarDeclare &var) {
-  std::cout << "var " << var.name << " ";
+  std::cout << (var.is_const ? "const " : "var ") << var.name << " ";
   debug_print(var.type);
   if (var.value.has_value()) {
     std::cout << " = ";
@@ -468,6 +637,23 @@ void debug_print(ASTWhile &whl) {
 
 void debug_print(ASTBreak &) { std::cout << "break" << std::endl; }
 
+void debug_print(ASTYield &y) {
+  std::cout << "yield ";
+  debug_print(y.what);
+  std::cout << std::endl;
+}
+
+void debug_print(ASTFor &loop) {
+  std::cout << "for " << loop.name << " in ";
+  debug_print(loop.source);
+  std::cout << " do " << std::endl;
+  for (auto &stmt : loop.body) {
+    debug_print(stmt);
+    std::cout << std::endl;
+  }
+  std::cout << "end" << std::endl;
+}
+
 void debug_print(ASTReturn &r) {
   std::cout << "return ";
   if (r.what.has_value())
@@ -480,7 +666,19 @@ void debug_print(Statement &p) {
 }
 
 void debug_print(ASTFuncDeclare &fdecl) {
-  std::cout << "func " << fdecl.name << "(";
+  if (fdecl.is_memo)
+    std::cout << "memo"
+              << (fdecl.memo_bound ? "(" + std::to_string(fdecl.memo_bound) + ")"
+                                   : "")
+              << " ";
+  std::cout << (fdecl.is_const ? "const func "
+                 : fdecl.is_gen ? "gen func "
+                                : "func ")
+            << fdecl.name;
+  for (size_t j = 0; j < fdecl.type_params.size(); ++j)
+    std::cout << (j == 0 ? "[" : ", ") << fdecl.type_params[j]
+              << (j + 1 == fdecl.type_params.size() ? "]" : "");
+  std::cout << "(";
   for (auto &param : fdecl.args) {
     std::cout << param.first << " ";
     debug_print(param.second);
@@ -496,6 +694,16 @@ void debug_print(ASTFuncDeclare &fdecl) {
   std::cout << "end" << std::endl;
 }
 
+void debug_print(ASTStructDeclare &sdecl) {
+  std::cout << "struct " << sdecl.name << " do" << std::endl;
+  for (auto &field : sdecl.fields) {
+    std::cout << field.first << " ";
+    debug_print(field.second);
+    std::cout << std::endl;
+  }
+  std::cout << "end" << std::endl;
+}
+
 void debug_print(Paragraph &p) {
   std::visit([](auto &arg) { debug_print(arg); }, p);
 }
@@ -509,10 +717,40 @@ std::optional<ASTBreak> ASTBuilder::parse_break() {
 std::optional<ASTReturn> ASTBuilder::parse_return() {
   if (!accept(TokenType::KwReturn))
     return std::nullopt;
+  Position pos = tokens[i - 1].loc;
   if (!stoppers.contains(tokens[i].type)) {
     auto opt = parse_expression();
     expect_value(opt, "Invalid expression near return");
-    return ASTReturn{std::move(opt)};
+    return ASTReturn{std::move(opt), pos};
+  }
+  return ASTReturn{std::nullopt, pos};
+}
+
+std::optional<ASTYield> ASTBuilder::parse_yield() {
+  if (!accept(TokenType::KwYield))
+    return std::nullopt;
+  Position pos = tokens[i - 1].loc;
+  auto opt = parse_expression();
+  expect_value(opt, "Expected value to yield.");
+  return ASTYield{std::move(opt.value()), pos};
+}
+
+std::optional<ASTFor> ASTBuilder::parse_for() {
+  if (!accept(TokenType::KwFor))
+    return std::nullopt;
+  Position pos = tokens[i - 1].loc;
+  expect(TokenType::Symbol, "Expected loop variable.");
+  std::string name = tokens[i - 1].lexeme;
+  expect(TokenType::KwIn, "Expected 'in'.");
+  auto opt = parse_expression();
+  expect_value(opt, "Expected generator call.");
+  Expr source = std::move(opt.value());
+  expect(TokenType::KwDo, "Expected do block.");
+  std::vector<Statement> body;
+  while (!accept(TokenType::KwEnd)) {
+    auto opt = parse_statement();
+    expect_value(opt, "Expected valid statement.");
+    body.push_back(std::move(opt.value()));
   }
-  return ASTReturn{std::nullopt};
+  return ASTFor{std::move(name), std::move(source), std::move(body), pos};
 }
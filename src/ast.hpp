@@ -2,15 +2,31 @@
 #include "lexer.hpp"
 #include <memory>
 #include <optional>
+#include <unordered_map>
 #include <variant>
 #include <vector>
 
+// Numeric types other than `int` and `float`, which are also called i32 and
+// f32, are fixed width: i8 to i64, u8 to u64 and f64.
+struct NumericType {
+  int bits;
+  bool is_float;
+  bool is_signed;
+};
+
+extern std::unordered_map<std::string, NumericType> numeric_types;
+
+// Name a type goes by in the AST, `int` for i32 and `float` for f32.
+std::string canonical_type(const std::string &name);
+
 struct ASTInt {
-  int value;
+  uint64_t value; // Fits in `type`, a suffix like 255u8 or int
+  std::string type = "int";
 };
 
 struct ASTFloat {
-  float value;
+  double value;
+  std::string type = "float";
 };
 
 struct ASTString {
@@ -43,8 +59,10 @@ enum class Operator {
   Pos,
   Neg,
   Ref,
+  Spawn, // Runs a call as a task, see the task runtime
   // Suffix
   Index,
+  Member,
   FuncCall // Cheaty bcus not held in ASTOperation
 };
 
@@ -71,13 +89,15 @@ struct Expr {
 
 struct ASTType {
   std::string name;
-  int count; // 0 if not an array, -1 if pointer
+  int count;        // 0 if not an array, -1 if pointer
+  bool soa = false; // Array of structs stored as one array per field
 };
 
 struct ASTVarDeclare {
   std::string name;
   ASTType type;
   std::optional<Expr> value;
+  bool is_const = false; // Value is computed while compiling
 };
 
 struct Statement;
@@ -87,35 +107,66 @@ struct ASTFuncDeclare {
   ASTType ret;
   std::vector<std::pair<std::string, ASTType>> args;
   std::vector<Statement> body;
+  Position pos;
+  bool is_const = false; // Can be evaluated while compiling
+  std::vector<std::string> type_params{}; // Empty unless generic
+  bool is_gen = false; // Yields values of type `ret` to a for loop
+  bool is_memo = false; // Caches its results by argument
+  long long memo_bound = 0; // Most results cached, 0 if unbounded
 };
 
 struct ASTWhile {
   Expr condition;
   std::vector<Statement> body;
+  Position pos;
 };
 
 struct ASTIf {
   using Branch = std::pair<Expr, std::vector<Statement>>;
   std::vector<Branch> branches;
   std::vector<Statement> otherwise;
+  Position pos;
 };
 
 struct ASTReturn {
   std::optional<Expr> what;
+  Position pos;
 };
 
 struct ASTBreak {};
 
-struct Statement {
-  std::variant<ASTVarDeclare, Expr, ASTWhile, ASTIf, ASTBreak, ASTReturn> value;
+// Hands a value to the for loop running the generator, which resumes after
+// the yield when the loop wants the next one.
+struct ASTYield {
+  Expr what;
+  Position pos;
+};
+
+// for x in g(...) do ... end runs the body on each value a generator yields.
+struct ASTFor {
+  std::string name;
+  Expr source;
+  std::vector<Statement> body;
+  Position pos;
 };
 
-using Paragraph = std::variant<Statement, ASTFuncDeclare>;
+struct Statement {
+  std::variant<ASTVarDeclare, Expr, ASTWhile, ASTIf, ASTBreak, ASTReturn,
+               ASTYield, ASTFor>
+      value;
+  Position pos{0};
+};
 
-struct ASTError : public std::runtime_error {
+struct ASTStructDeclare {
+  std::string name;
+  std::vector<std::pair<std::string, ASTType>> fields;
   Position pos;
-  ASTError(Position pos, std::string what)
-      : pos(pos), std::runtime_error(what) {}
+};
+
+using Paragraph = std::variant<Statement, ASTFuncDeclare, ASTStructDeclare>;
+
+struct ASTError : public SourceError {
+  using SourceError::SourceError;
 };
 
 void debug_print(Paragraph &p);
@@ -148,8 +199,12 @@ struct ASTBuilder {
 
   std::optional<ASTSingular> parse_singular();
 
+  ASTSingular parse_number();
+
   std::optional<ASTType> parse_type();
 
+  std::string parse_element_type();
+
   std::optional<ASTVarDeclare> parse_vardecl();
 
   std::optional<ASTWhile> parse_while();
@@ -158,10 +213,16 @@ struct ASTBuilder {
 
   std::optional<ASTFuncDeclare> parse_funcdecl();
 
+  std::optional<ASTStructDeclare> parse_structdecl();
+
   std::optional<ASTBreak> parse_break();
 
   std::optional<ASTReturn> parse_return();
 
+  std::optional<ASTYield> parse_yield();
+
+  std::optional<ASTFor> parse_for();
+
   std::optional<Statement> parse_statement();
 
   std::optional<Expr> parse_expression(int prec = 0);
@@ -0,0 +1,539 @@
+#include "astfile.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <span>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+// An AST file is a header followed by sections of native-endian records,
+// each section starting at a multiple of four bytes:
+//
+//   strings  offset of every string in the text, then where the text ends
+//   text     the bytes of every distinct string, one after another
+//   nodes    fixed-size Node records, children always before their parents
+//   lists    each a count followed by that many node indices
+//   lines    line start offsets of the source, as in LineTable
+//
+// Records refer to each other by index only, so the file is read in place
+// wherever it is mapped. As children come first, loading walks each node
+// once and can't loop even on a damaged file. `ast_version` changes with
+// Node, NodeKind or Operator.
+//
+// While, if, return, yield and for statements share their statement's
+// position, which is where the parser puts them, so it is stored once.
+
+static constexpr char ast_magic[8] = {'I', 'N', 'N', 'A', 'S', 'T', 0, 0};
+static constexpr uint32_t ast_version = 4;
+static constexpr uint32_t none = UINT32_MAX; // Missing child
+
+enum class NodeKind : uint8_t {
+  Int,           // tag: literal type, a and b: low and high bits
+  Float,         // tag: literal type, a and b: low and high bits
+  String,        // a: string
+  Symbol,        // a: string
+  Operation,     // tag: Operator, a: left, b: right
+  Array,         // a: list of values
+  FuncCall,      // a: callee, b: list of arguments
+  Type,          // a: name, b: count
+  TypeParam,     // a: name
+  Field,         // a: name, b: type
+  VarDeclare,    // a: field, b: value
+  ExprStatement, // a: expression
+  While,         // a: condition, b: list of statements
+  If,            // a: list of branches, b: list of statements for else
+  Branch,        // a: condition, b: list of statements
+  Return,        // a: value
+  Break,
+  Yield,         // a: value
+  For,           // a: name, b: list of the source and statements
+  FuncDeclare,   // a: name, b: list of the return type, memo bound, type
+                 // parameters, fields and statements, which differ in kind
+  StructDeclare, // a: name, b: list of fields
+  Memo           // a and b: low and high bits of the bound, 0 if none
+};
+
+static constexpr uint16_t flag_const = 1, flag_soa = 2, flag_gen = 4;
+
+// Types a literal can have, by their number in the tag.
+static const std::string literal_types[] = {
+    "int", "i8", "i16", "i64", "u8", "u16", "u32", "u64", "float", "f64"};
+
+static uint8_t literal_type(const std::string &type) {
+  return std::find(std::begin(literal_types), std::end(literal_types), type) -
+         std::begin(literal_types);
+}
+
+struct Node {
+  NodeKind kind;
+  uint8_t tag;
+  uint16_t flags;
+  uint32_t pos; // Of a statement or declaration
+  uint32_t a = none, b = none;
+};
+static_assert(sizeof(Node) == 16);
+
+struct Section {
+  uint32_t offset; // In bytes from the start of the file
+  uint32_t count;
+};
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t source_name; // String
+  uint32_t roots;       // List
+  Section strings, text, nodes, lists, lines;
+};
+
+struct ASTWriter {
+  std::vector<uint32_t> string_offsets{};
+  std::string text{};
+  std::unordered_map<std::string, uint32_t> string_ids{};
+  std::vector<Node> nodes{};
+  std::vector<uint32_t> lists{};
+
+  uint32_t string(const std::string &s) {
+    auto [it, added] = string_ids.try_emplace(s, string_offsets.size());
+    if (added) {
+      string_offsets.push_back(text.size());
+      text += s;
+    }
+    return it->second;
+  }
+
+  uint32_t list(const std::vector<uint32_t> &items) {
+    uint32_t at = lists.size();
+    lists.push_back(items.size());
+    lists.insert(lists.end(), items.begin(), items.end());
+    return at;
+  }
+
+  // Children are added while the arguments are evaluated, so always first.
+  uint32_t add(Node node) {
+    nodes.push_back(node);
+    return nodes.size() - 1;
+  }
+
+  uint32_t add(const ASTInt &i) {
+    return add({NodeKind::Int, literal_type(i.type), 0, 0, (uint32_t)i.value,
+                (uint32_t)(i.value >> 32)});
+  }
+
+  uint32_t add(const ASTFloat &f) {
+    uint64_t bits = std::bit_cast<uint64_t>(f.value);
+    return add({NodeKind::Float, literal_type(f.type), 0, 0, (uint32_t)bits,
+                (uint32_t)(bits >> 32)});
+  }
+
+  uint32_t add(const ASTString &s) {
+    return add({NodeKind::String, 0, 0, 0, string(s.value)});
+  }
+
+  uint32_t add(const ASTSymbol &s) {
+    return add({NodeKind::Symbol, 0, 0, 0, string(s.value)});
+  }
+
+  uint32_t add(const ASTSingular &s) {
+    return std::visit([&](auto &arg) { return add(arg); }, s);
+  }
+
+  uint32_t add(const ASTOperation &op) {
+    uint32_t left = op.left ? add(*op.left) : none;
+    uint32_t right = op.right ? add(*op.right) : none;
+    return add({NodeKind::Operation, (uint8_t)op.op, 0, 0, left, right});
+  }
+
+  uint32_t add(const ASTArray &arr) {
+    return add({NodeKind::Array, 0, 0, 0, add(arr.values)});
+  }
+
+  uint32_t add(const ASTFuncCall &call) {
+    uint32_t callee = add(*call.callee);
+    return add({NodeKind::FuncCall, 0, 0, 0, callee, add(call.args)});
+  }
+
+  uint32_t add(const Expr &e) {
+    return std::visit([&](auto &arg) { return add(arg); }, e.value);
+  }
+
+  uint32_t add(const std::vector<Expr> &values) {
+    std::vector<uint32_t> items{};
+    for (auto &value : values)
+      items.push_back(add(value));
+    return list(items);
+  }
+
+  uint32_t add(const ASTType &type) {
+    return add({NodeKind::Type, 0, type.soa ? flag_soa : (uint16_t)0, 0,
+                string(type.name), (uint32_t)type.count});
+  }
+
+  uint32_t add_field(const std::string &name, const ASTType &type) {
+    uint32_t t = add(type);
+    return add({NodeKind::Field, 0, 0, 0, string(name), t});
+  }
+
+  uint32_t add(const Statement &stmt) {
+    Node node{NodeKind::Break, 0, 0, stmt.pos.offset};
+    if (auto var = std::get_if<ASTVarDeclare>(&stmt.value)) {
+      node.kind = NodeKind::VarDeclare;
+      node.flags = var->is_const ? flag_const : 0;
+      node.a = add_field(var->name, var->type);
+      node.b = var->value ? add(*var->value) : none;
+    } else if (auto e = std::get_if<Expr>(&stmt.value)) {
+      node.kind = NodeKind::ExprStatement;
+      node.a = add(*e);
+    } else if (auto loop = std::get_if<ASTWhile>(&stmt.value)) {
+      node.kind = NodeKind::While;
+      node.a = add(loop->condition);
+      node.b = add(loop->body);
+    } else if (auto cond = std::get_if<ASTIf>(&stmt.value)) {
+      std::vector<uint32_t> branches{};
+      for (auto &[test, body] : cond->branches) {
+        uint32_t t = add(test);
+        branches.push_back(add({NodeKind::Branch, 0, 0, 0, t, add(body)}));
+      }
+      node.kind = NodeKind::If;
+      node.a = list(branches);
+      node.b = add(cond->otherwise);
+    } else if (auto ret = std::get_if<ASTReturn>(&stmt.value)) {
+      node.kind = NodeKind::Return;
+      node.a = ret->what ? add(*ret->what) : none;
+    } else if (auto yld = std::get_if<ASTYield>(&stmt.value)) {
+      node.kind = NodeKind::Yield;
+      node.a = add(yld->what);
+    } else if (auto loop = std::get_if<ASTFor>(&stmt.value)) {
+      std::vector<uint32_t> items{add(loop->source)};
+      for (auto &inner : loop->body)
+        items.push_back(add(inner));
+      node.kind = NodeKind::For;
+      node.a = string(loop->name);
+      node.b = list(items);
+    }
+    return add(node);
+  }
+
+  uint32_t add(const std::vector<Statement> &body) {
+    std::vector<uint32_t> items{};
+    for (auto &stmt : body)
+      items.push_back(add(stmt));
+    return list(items);
+  }
+
+  uint32_t add(const ASTFuncDeclare &func) {
+    std::vector<uint32_t> items{add(func.ret)};
+    if (func.is_memo)
+      items.push_back(add({NodeKind::Memo, 0, 0, 0, (uint32_t)func.memo_bound,
+                           (uint32_t)(func.memo_bound >> 32)}));
+    for (auto &name : func.type_params)
+      items.push_back(add({NodeKind::TypeParam, 0, 0, 0, string(name)}));
+    for (auto &[name, type] : func.args)
+      items.push_back(add_field(name, type));
+    for (auto &stmt : func.body)
+      items.push_back(add(stmt));
+    uint16_t flags = (func.is_const ? flag_const : 0) |
+                     (func.is_gen ? flag_gen : 0);
+    return add({NodeKind::FuncDeclare, 0, flags, func.pos.offset,
+                string(func.name), list(items)});
+  }
+
+  uint32_t add(const ASTStructDeclare &sdecl) {
+    std::vector<uint32_t> fields{};
+    for (auto &[name, type] : sdecl.fields)
+      fields.push_back(add_field(name, type));
+    return add({NodeKind::StructDeclare, 0, 0, sdecl.pos.offset,
+                string(sdecl.name), list(fields)});
+  }
+};
+
+void save_ast(const std::string &path, const std::vector<Paragraph> &roots,
+              const std::string &source_name, LineTable &lines) {
+  ASTWriter writer{};
+  std::vector<uint32_t> items{};
+  for (auto &para : roots)
+    items.push_back(std::visit([&](auto &arg) { return writer.add(arg); }, para));
+  Header header{};
+  memcpy(header.magic, ast_magic, sizeof(ast_magic));
+  header.version = ast_version;
+  header.source_name = writer.string(source_name);
+  header.roots = writer.list(items);
+  writer.string_offsets.push_back(writer.text.size());
+
+  std::string out(sizeof(Header), '\0');
+  auto section = [&](const void *data, size_t count, size_t size) {
+    Section res{(uint32_t)out.size(), (uint32_t)count};
+    out.append(static_cast<const char *>(data), count * size);
+    out.resize((out.size() + 3) & ~(size_t)3, '\0');
+    return res;
+  };
+  header.strings = section(writer.string_offsets.data(),
+                           writer.string_offsets.size(), sizeof(uint32_t));
+  header.text = section(writer.text.data(), writer.text.size(), 1);
+  header.nodes = section(writer.nodes.data(), writer.nodes.size(), sizeof(Node));
+  header.lists =
+      section(writer.lists.data(), writer.lists.size(), sizeof(uint32_t));
+  auto &starts = lines.lines();
+  header.lines = section(starts.data(), starts.size(), sizeof(uint32_t));
+  if (out.size() > UINT32_MAX)
+    throw std::runtime_error(path + ": AST is too large to save");
+  memcpy(out.data(), &header, sizeof(Header));
+
+  std::ofstream file(path, std::ios::binary);
+  file.write(out.data(), out.size());
+  if (!file)
+    throw std::runtime_error("Can't write " + path);
+}
+
+struct ASTReader {
+  const std::string &path;
+  const char *data;
+  size_t size;
+  const Header *header = nullptr;
+  const uint32_t *string_offsets = nullptr, *lists = nullptr;
+  const char *text = nullptr;
+  const Node *nodes = nullptr;
+
+  [[noreturn]] void fail() {
+    throw std::runtime_error(path + ": damaged AST file");
+  }
+
+  template <typename T> const T *section(Section s) {
+    if (s.offset % 4 != 0 || s.offset > size ||
+        (uint64_t)s.count * sizeof(T) > size - s.offset)
+      fail();
+    return reinterpret_cast<const T *>(data + s.offset);
+  }
+
+  std::string string(uint32_t i) {
+    if (i >= header->strings.count - 1)
+      fail();
+    uint32_t from = string_offsets[i], to = string_offsets[i + 1];
+    if (from > to || to > header->text.count)
+      fail();
+    return std::string(text + from, to - from);
+  }
+
+  static uint64_t wide(const Node &n) { return n.a | (uint64_t)n.b << 32; }
+
+  const std::string &literal(uint8_t tag) {
+    if (tag >= std::size(literal_types))
+      fail();
+    return literal_types[tag];
+  }
+
+  // Only nodes before `parent` can be its children.
+  const Node &node(uint32_t i, uint32_t parent) {
+    if (i >= parent)
+      fail();
+    return nodes[i];
+  }
+
+  std::span<const uint32_t> list(uint32_t at) {
+    if (at >= header->lists.count || lists[at] > header->lists.count - at - 1)
+      fail();
+    return {lists + at + 1, lists[at]};
+  }
+
+  ASTType type(uint32_t i, uint32_t parent) {
+    const Node &n = node(i, parent);
+    if (n.kind != NodeKind::Type)
+      fail();
+    return ASTType{string(n.a), (int)n.b, (n.flags & flag_soa) != 0};
+  }
+
+  std::pair<std::string, ASTType> field(uint32_t i, uint32_t parent) {
+    const Node &n = node(i, parent);
+    if (n.kind != NodeKind::Field)
+      fail();
+    return {string(n.a), type(n.b, i)};
+  }
+
+  Expr expr(uint32_t i, uint32_t parent) {
+    const Node &n = node(i, parent);
+    switch (n.kind) {
+    case NodeKind::Int:
+      return Expr{ASTSingular{ASTInt{wide(n), literal(n.tag)}}};
+    case NodeKind::Float:
+      return Expr{ASTSingular{
+          ASTFloat{std::bit_cast<double>(wide(n)), literal(n.tag)}}};
+    case NodeKind::String:
+      return Expr{ASTSingular{ASTString{string(n.a)}}};
+    case NodeKind::Symbol:
+      return Expr{ASTSingular{ASTSymbol{string(n.a)}}};
+    case NodeKind::Operation: {
+      if (n.tag > (uint8_t)Operator::FuncCall)
+        fail();
+      ASTOperation op{(Operator)n.tag, nullptr, nullptr};
+      if (n.a != none)
+        op.left = std::make_unique<Expr>(expr(n.a, i));
+      if (n.b != none)
+        op.right = std::make_unique<Expr>(expr(n.b, i));
+      return Expr{std::move(op)};
+    }
+    case NodeKind::Array:
+      return Expr{ASTArray{exprs(n.a, i)}};
+    case NodeKind::FuncCall:
+      return Expr{
+          ASTFuncCall{std::make_unique<Expr>(expr(n.a, i)), exprs(n.b, i)}};
+    default:
+      fail();
+    }
+  }
+
+  std::vector<Expr> exprs(uint32_t at, uint32_t parent) {
+    std::vector<Expr> res{};
+    for (uint32_t i : list(at))
+      res.push_back(expr(i, parent));
+    return res;
+  }
+
+  Statement statement(uint32_t i, uint32_t parent) {
+    const Node &n = node(i, parent);
+    Position pos{n.pos};
+    switch (n.kind) {
+    case NodeKind::VarDeclare: {
+      auto [name, type] = field(n.a, i);
+      std::optional<Expr> value{};
+      if (n.b != none)
+        value = expr(n.b, i);
+      return Statement{ASTVarDeclare{std::move(name), std::move(type),
+                                     std::move(value),
+                                     (n.flags & flag_const) != 0},
+                       pos};
+    }
+    case NodeKind::ExprStatement:
+      return Statement{expr(n.a, i), pos};
+    case NodeKind::While:
+      return Statement{ASTWhile{expr(n.a, i), body(n.b, i), pos}, pos};
+    case NodeKind::If: {
+      ASTIf cond{{}, body(n.b, i), pos};
+      for (uint32_t b : list(n.a)) {
+        const Node &branch = node(b, i);
+        if (branch.kind != NodeKind::Branch)
+          fail();
+        cond.branches.emplace_back(expr(branch.a, b), body(branch.b, b));
+      }
+      return Statement{std::move(cond), pos};
+    }
+    case NodeKind::Return: {
+      std::optional<Expr> what{};
+      if (n.a != none)
+        what = expr(n.a, i);
+      return Statement{ASTReturn{std::move(what), pos}, pos};
+    }
+    case NodeKind::Break:
+      return Statement{ASTBreak{}, pos};
+    case NodeKind::Yield:
+      return Statement{ASTYield{expr(n.a, i), pos}, pos};
+    case NodeKind::For: {
+      auto items = list(n.b);
+      if (items.empty())
+        fail();
+      ASTFor loop{string(n.a), expr(items[0], i), {}, pos};
+      for (uint32_t item : items.subspan(1))
+        loop.body.push_back(statement(item, i));
+      return Statement{std::move(loop), pos};
+    }
+    default:
+      fail();
+    }
+  }
+
+  std::vector<Statement> body(uint32_t at, uint32_t parent) {
+    std::vector<Statement> res{};
+    for (uint32_t i : list(at))
+      res.push_back(statement(i, parent));
+    return res;
+  }
+
+  Paragraph paragraph(uint32_t i, uint32_t parent) {
+    const Node &n = node(i, parent);
+    if (n.kind == NodeKind::FuncDeclare) {
+      auto items = list(n.b);
+      if (items.empty())
+        fail();
+      ASTFuncDeclare func{string(n.a),    type(items[0], i), {}, {},
+                          Position{n.pos}, (n.flags & flag_const) != 0};
+      func.is_gen = (n.flags & flag_gen) != 0;
+      for (uint32_t item : items.subspan(1)) {
+        NodeKind kind = node(item, i).kind;
+        if (kind == NodeKind::Memo) {
+          func.is_memo = true;
+          func.memo_bound = (long long)wide(nodes[item]);
+        } else if (kind == NodeKind::TypeParam)
+          func.type_params.push_back(string(nodes[item].a));
+        else if (kind == NodeKind::Field)
+          func.args.push_back(field(item, i));
+        else
+          func.body.push_back(statement(item, i));
+      }
+      return func;
+    }
+    if (n.kind == NodeKind::StructDeclare) {
+      ASTStructDeclare sdecl{string(n.a), {}, Position{n.pos}};
+      for (uint32_t item : list(n.b))
+        sdecl.fields.push_back(field(item, i));
+      return sdecl;
+    }
+    return statement(i, parent);
+  }
+
+  ASTFile read() {
+    header = reinterpret_cast<const Header *>(data);
+    if (size < sizeof(Header) ||
+        memcmp(header->magic, ast_magic, sizeof(ast_magic)) != 0)
+      throw std::runtime_error(path + ": not an AST file");
+    if (header->version != ast_version)
+      throw std::runtime_error(path + ": AST file is version " +
+                               std::to_string(header->version) +
+                               ", expected version " +
+                               std::to_string(ast_version));
+    string_offsets = section<uint32_t>(header->strings);
+    text = section<char>(header->text);
+    nodes = section<Node>(header->nodes);
+    lists = section<uint32_t>(header->lists);
+    auto starts = section<uint32_t>(header->lines);
+    if (header->strings.count == 0 || header->lines.count == 0 ||
+        starts[0] != 0)
+      fail();
+    ASTFile res{string(header->source_name), {starts[0]}, {}};
+    for (uint32_t i = 1; i < header->lines.count; ++i) {
+      if (starts[i] <= starts[i - 1])
+        fail();
+      res.line_starts.push_back(starts[i]);
+    }
+    for (uint32_t i : list(header->roots))
+      res.roots.push_back(paragraph(i, header->nodes.count));
+    return res;
+  }
+};
+
+ASTFile load_ast(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st {};
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    if (fd >= 0)
+      close(fd);
+    throw std::runtime_error("Can't read " + path);
+  }
+  size_t size = st.st_size;
+  void *map = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0)
+                       : MAP_FAILED;
+  close(fd);
+  if (map == MAP_FAILED)
+    throw std::runtime_error(path + ": not an AST file");
+  try {
+    ASTFile res = ASTReader{path, static_cast<const char *>(map), size}.read();
+    munmap(map, size);
+    return res;
+  } catch (...) {
+    munmap(map, size);
+    throw;
+  }
+}
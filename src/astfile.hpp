@@ -0,0 +1,22 @@
+#pragma once
+#include "ast.hpp"
+#include "lexer.hpp"
+#include <string>
+#include <vector>
+
+// A parsed program saved in a binary file, so later stages can start from
+// the AST instead of lexing and parsing the source again. The layout is
+// described in astfile.cpp.
+
+struct ASTFile {
+  std::string source_name;           // For diagnostics and #line
+  std::vector<uint32_t> line_starts; // As in LineTable
+  std::vector<Paragraph> roots;
+};
+
+void save_ast(const std::string &path, const std::vector<Paragraph> &roots,
+              const std::string &source_name, LineTable &lines);
+
+// Throws std::runtime_error if the file isn't a valid AST file of this
+// version.
+ASTFile load_ast(const std::string &path);
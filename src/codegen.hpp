@@ -1,9 +1,48 @@
 #pragma once
 
 #include "ast.hpp"
+#include "eval.hpp"
+#include "runtime.hpp"
+#include <algorithm>
+#include <charconv>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <sstream>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+struct CodegenOptions {
+  bool profile = false;
+  std::string source_name = "<input>";
+  bool tail_report = false;
+  bool effects_report = false;
+  bool debug = false; // Map the C back to the source with #line
+  long long stack_array_limit = 65536; // Bytes, larger local arrays go on the heap
+  bool shared = false; // Build a library exporting its funcs, with a header
+};
+
+CodegenOptions codegen_options{};
+
+struct ProfileSite {
+  std::string name;
+  Position pos;
+};
+
+std::vector<ProfileSite> profile_funcs{};
+std::vector<ProfileSite> profile_loops{};
+
+// Lines of the file being compiled, for printing positions.
+LineTable source_lines{};
+
+std::string source_location(Position pos) {
+  auto [row, col] = source_lines.locate(pos);
+  return codegen_options.source_name + ":" + std::to_string(row) + ":" +
+         std::to_string(col);
+}
+
 std::string quote(const std::string &str) {
   std::string result = "\"";
   for (char c : str) {
@@ -32,35 +71,1084 @@ std::string quote(const std::string &str) {
   return result;
 }
 
+std::unordered_map<std::string, std::string> types{
+    {"int", "int"},
+    {"float", "float"},
+    {"i8", "int8_t"},
+    {"i16", "int16_t"},
+    {"i64", "int64_t"},
+    {"u8", "uint8_t"},
+    {"u16", "uint16_t"},
+    {"u32", "uint32_t"},
+    {"u64", "uint64_t"},
+    {"f64", "double"},
+    {"string", "inn_str"},
+    {"void", "void"},
+    {"region", "inn_region*"},
+    {"builder", "inn_builder"},
+    {"vec4f", "inn_vec4f"},
+    {"vec8f", "inn_vec8f"},
+    {"vec4i", "inn_vec4i"},
+    {"vec8i", "inn_vec8i"},
+    {"scanner", "inn_scanner"}};
+
+// Runtime module backing each non-primitive type.
+std::unordered_map<std::string, std::string> type_modules{
+    {"string", "string"}, {"region", "region"}, {"builder", "string"},
+    {"vec4f", "simd"},    {"vec8f", "simd"},    {"vec4i", "simd"},
+    {"vec8i", "simd"},    {"scanner", "file"}};
+
+// Lane type and count of the builtin vector types.
+std::unordered_map<std::string, std::pair<std::string, int>> vector_types{
+    {"vec4f", {"float", 4}},
+    {"vec8f", {"float", 8}},
+    {"vec4i", {"int", 4}},
+    {"vec8i", {"int", 8}}};
+
+struct Builtin {
+  std::string c_name;
+  std::string module;
+  ASTType ret{};        // Empty name if unknown
+  bool by_ref = false; // First argument is passed by address
+};
+
+std::unordered_map<std::string, Builtin> builtins{
+    {"region_create", {"inn_region_create", "region", {"region", 0}}},
+    {"region_alloc", {"inn_region_alloc", "region"}},
+    {"region_reset", {"inn_region_reset", "region"}},
+    {"region_destroy", {"inn_region_destroy", "region"}},
+    {"len", {"inn_len", "string", {"int", 0}}},
+    {"slice", {"inn_str_slice", "string", {"string", 0}}},
+    {"concat", {"inn_str_concat", "string", {"string", 0}}},
+    {"cstr", {"inn_cstr", "string"}},
+    {"flush", {"inn_flush", "print"}},
+    {"map_file", {"inn_map_file", "file", {"string", 0}}},
+    {"unmap_file", {"inn_unmap_file", "file"}},
+    {"scan", {"inn_scan", "file", {"scanner", 0}}},
+    {"scan_done", {"inn_scan_done", "file", {"int", 0}, true}},
+    {"next_line", {"inn_next_line", "file", {"string", 0}, true}},
+    {"next_field", {"inn_next_field", "file", {"string", 0}, true}},
+    {"parse_int", {"inn_parse_int", "file", {"int", 0}}},
+    {"parse_float", {"inn_parse_float", "file", {"float", 0}}},
+    {"builder_append", {"inn_builder_append", "string", {}, true}},
+    {"builder_finish", {"inn_builder_finish", "string", {"string", 0}, true}},
+    {"vec4f_load", {"inn_vec4f_load", "simd", {"vec4f", 0}}},
+    {"vec4f_store", {"inn_vec4f_store", "simd"}},
+    {"vec4f_splat", {"inn_vec4f_splat", "simd", {"vec4f", 0}}},
+    {"vec4f_sum", {"inn_vec4f_sum", "simd", {"float", 0}}},
+    {"vec8f_load", {"inn_vec8f_load", "simd", {"vec8f", 0}}},
+    {"vec8f_store", {"inn_vec8f_store", "simd"}},
+    {"vec8f_splat", {"inn_vec8f_splat", "simd", {"vec8f", 0}}},
+    {"vec8f_sum", {"inn_vec8f_sum", "simd", {"float", 0}}},
+    {"vec4i_load", {"inn_vec4i_load", "simd", {"vec4i", 0}}},
+    {"vec4i_store", {"inn_vec4i_store", "simd"}},
+    {"vec4i_splat", {"inn_vec4i_splat", "simd", {"vec4i", 0}}},
+    {"vec4i_sum", {"inn_vec4i_sum", "simd", {"int", 0}}},
+    {"vec8i_load", {"inn_vec8i_load", "simd", {"vec8i", 0}}},
+    {"vec8i_store", {"inn_vec8i_store", "simd"}},
+    {"vec8i_splat", {"inn_vec8i_splat", "simd", {"vec8i", 0}}},
+    {"vec8i_sum", {"inn_vec8i_sum", "simd", {"int", 0}}}};
+
+// Builtins over int or float arrays, or pointers with a length, and how many
+// arrays each one takes. count_if is lowered inline.
+std::unordered_map<std::string, size_t> reductions{
+    {"sum", 1}, {"min", 1},        {"max", 1},
+    {"dot", 2}, {"prefix_sum", 1}, {"count_if", 1}};
+
+// Builtins over maps and how many arguments each takes. map_keys and
+// map_values are only for loops.
+std::unordered_map<std::string, size_t> map_builtins{
+    {"map_has", 2},   {"map_del", 2},  {"map_len", 1},  {"map_reserve", 2},
+    {"map_clear", 1}, {"map_free", 1}, {"map_keys", 1}, {"map_values", 1}};
+
+// Runtime modules in the order they were first needed.
+std::vector<std::string> runtime_modules{};
+
+// Modules whose C code uses another module's.
+std::unordered_map<std::string, std::string> runtime_requires{
+    {"reduce", "simd"}, {"file", "string"}};
+
+void require_runtime(const std::string &module) {
+  if (runtime_requires.contains(module))
+    require_runtime(runtime_requires[module]);
+  if (std::find(runtime_modules.begin(), runtime_modules.end(), module) ==
+      runtime_modules.end())
+    runtime_modules.push_back(module);
+}
+
+std::unordered_map<std::string, const ASTFuncDeclare *> functions{};
+
+std::unordered_map<std::string, const ASTStructDeclare *> structs{};
+
+// What calling a function can observe or change, worked out for all of them
+// before any C is generated. Const functions depend only on their argument
+// values, pure ones also read memory, and the rest have side effects.
+enum class Purity { Const, Pure, Impure };
+
+struct Effects {
+  Purity purity = Purity::Const; // Not counting writes through parameters
+  std::string reason{};          // What made it less than const
+  // Per parameter, only set for arrays and pointers.
+  std::vector<bool> written{}, read_only{}, restricted{};
+  bool global_memory = false; // Uses global arrays, itself or in calls
+  // Why it reads memory which may change, empty if it only reads strings.
+  std::string changing{};
+  // Proven to return, needing every loop counted and no recursion. Calls to
+  // a const or pure function which may not return can't be dropped.
+  bool terminates = false;
+};
+
+std::unordered_map<std::string, Effects> effects{};
+bool effects_changed = false;
+
+using TypeBindings = std::unordered_map<std::string, std::string>;
+
+// Type parameters bound while generating an instance of a generic function.
+TypeBindings type_bindings{};
+
+// Task handles are typed by what their function returns, task[int].
+bool is_task(const std::optional<ASTType> &type) {
+  return type.has_value() && type->count == 0 &&
+         type->name.starts_with("task[");
+}
+
+ASTType task_result(const ASTType &type) {
+  return ASTType{type.name.substr(5, type.name.size() - 6), 0};
+}
+
+// Maps are typed by their keys and values, map[string]int.
+bool is_map(const std::optional<ASTType> &type) {
+  return type.has_value() && type->name.starts_with("map[");
+}
+
+ASTType map_key(const ASTType &type) {
+  return ASTType{type.name.substr(4, type.name.find(']') - 4), 0};
+}
+
+ASTType map_value(const ASTType &type) {
+  return ASTType{type.name.substr(type.name.find(']') + 1), 0};
+}
+
+// soa arrays and maps are passed by address, so callees can change them.
+bool by_address(const ASTType &type) {
+  return type.soa || (is_map(type) && type.count == 0);
+}
+
+ASTType resolve_type(const ASTType &type) {
+  if (is_task(type))
+    return ASTType{"task[" + resolve_type(task_result(type)).name + "]", 0};
+  if (is_map(type))
+    return ASTType{"map[" + resolve_type(map_key(type)).name + "]" +
+                       resolve_type(map_value(type)).name,
+                   type.count};
+  auto it = type_bindings.find(type.name);
+  if (it == type_bindings.end())
+    return type;
+  return ASTType{it->second, type.count, type.soa};
+}
+
+struct Scope {
+  std::unordered_map<std::string, ASTType> vars{};
+  // C expression for variables which aren't simply their Inn name.
+  std::unordered_map<std::string, std::string> c_names{};
+  // Values of the constants declared in this scope.
+  std::unordered_map<std::string, Value> consts{};
+  // Buffer of each string variable owning one, see generate_owned_string.
+  std::unordered_map<std::string, std::string> owners{};
+};
+
+// Variables visible at the current point of generation, innermost last.
+std::vector<Scope> scopes{{}};
+
+void declare_var(const std::string &name, const ASTType &type,
+                 const std::string &c_name = "") {
+  scopes.back().vars[name] = resolve_type(type);
+  scopes.back().consts.erase(name);
+  scopes.back().owners.erase(name);
+  if (c_name.empty())
+    scopes.back().c_names.erase(name);
+  else
+    scopes.back().c_names[name] = c_name;
+}
+
+std::optional<ASTType> lookup_var(const std::string &name) {
+  for (auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
+    auto found = it->vars.find(name);
+    if (found != it->vars.end())
+      return found->second;
+  }
+  return std::nullopt;
+}
+
+std::string var_c_name(const std::string &name) {
+  for (auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
+    if (!it->vars.contains(name))
+      continue;
+    auto found = it->c_names.find(name);
+    return found != it->c_names.end() ? found->second : name;
+  }
+  return name;
+}
+
+// C name of the buffer owned by string variable `name`, empty if it has none.
+std::string string_owner(const std::string &name) {
+  for (auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
+    if (!it->vars.contains(name))
+      continue;
+    auto found = it->owners.find(name);
+    return found != it->owners.end() ? found->second : "";
+  }
+  return "";
+}
+
+// Value of `name` if it refers to a constant.
+const Value *const_value(const std::string &name, bool file_scope = false) {
+  for (size_t i = file_scope ? 1 : scopes.size(); i > 0; --i) {
+    if (!scopes[i - 1].vars.contains(name))
+      continue;
+    auto found = scopes[i - 1].consts.find(name);
+    return found != scopes[i - 1].consts.end() ? &found->second : nullptr;
+  }
+  return nullptr;
+}
+
+// Variable an lvalue like a[i].x belongs to, empty if there's none.
+std::string root_name(const Expr &ex) {
+  if (auto sing = std::get_if<ASTSingular>(&ex.value))
+    if (auto sym = std::get_if<ASTSymbol>(sing))
+      return sym->value;
+  auto op = std::get_if<ASTOperation>(&ex.value);
+  if (op != nullptr && (op->op == Operator::Index || op->op == Operator::Member))
+    return root_name(*op->left);
+  return "";
+}
+
+std::optional<ASTType> field_type(const ASTType &base,
+                                  const std::string &field) {
+  auto it = structs.find(base.name);
+  if (it == structs.end())
+    return std::nullopt;
+  for (auto &f : it->second->fields)
+    if (f.first == field)
+      return f.second;
+  throw std::runtime_error("Struct " + base.name + " has no field " + field +
+                           ".");
+}
+
+std::string member_name(const ASTOperation &op) {
+  return std::get<ASTSymbol>(std::get<ASTSingular>(op.right->value)).value;
+}
+
+std::string symbol_name(const Expr &ex) {
+  if (auto sing = std::get_if<ASTSingular>(&ex.value))
+    if (auto sym = std::get_if<ASTSymbol>(sing))
+      return sym->value;
+  return "";
+}
+
+bool is_generic(const ASTFuncDeclare &fdecl) {
+  return !fdecl.type_params.empty();
+}
+
+// Explicit type argument of a generic call like f[float](...), if any.
+std::string explicit_type_arg(const ASTFuncCall &fcall) {
+  auto op = std::get_if<ASTOperation>(&fcall.callee->value);
+  if (op == nullptr || op->op != Operator::Index || op->right == nullptr)
+    return "";
+  auto it = functions.find(symbol_name(*op->left));
+  if (it == functions.end() || !is_generic(*it->second))
+    return "";
+  return symbol_name(*op->right);
+}
+
+// Name of the called function, or empty if the callee isn't a plain symbol.
+std::string callee_name(const ASTFuncCall &fcall) {
+  if (!explicit_type_arg(fcall).empty())
+    return symbol_name(*std::get<ASTOperation>(fcall.callee->value).left);
+  return symbol_name(*fcall.callee);
+}
+
+bool is_builtin_call(const ASTFuncCall &fcall, const std::string &name) {
+  return callee_name(fcall) == name && !functions.contains(name);
+}
+
+std::optional<ASTType> infer_type(const Expr &ex);
+
+// Binds the type parameters of a generic function from an explicit type
+// argument and the types of the call's arguments. Sets `error` and returns
+// nothing if they can't all be bound consistently.
+std::optional<TypeBindings> bind_type_params(const ASTFuncDeclare &fdecl,
+                                             const ASTFuncCall &fcall,
+                                             std::string &error) {
+  TypeBindings res{};
+  std::string given = explicit_type_arg(fcall);
+  if (!given.empty())
+    res[fdecl.type_params[0]] = given;
+  auto &params = fdecl.type_params;
+  for (size_t i = 0; i < fdecl.args.size() && i < fcall.args.size(); ++i) {
+    auto &param = fdecl.args[i].second;
+    if (std::find(params.begin(), params.end(), param.name) == params.end())
+      continue;
+    auto arg = infer_type(fcall.args[i]);
+    if (!arg.has_value())
+      continue;
+    // Arrays are passed as pointers, so they match []T.
+    bool shape = param.count == -1 ? arg->count != 0
+                                   : arg->count == param.count;
+    if (!shape || arg->soa != param.soa) {
+      error = "Argument " + std::to_string(i + 1) + " of " + fdecl.name +
+              " doesn't have the shape of its parameter.";
+      return std::nullopt;
+    }
+    auto [it, added] = res.emplace(param.name, arg->name);
+    if (!added && it->second != arg->name) {
+      error = "In the call to " + fdecl.name + ", " + param.name +
+              " is both " + it->second + " and " + arg->name + ".";
+      return std::nullopt;
+    }
+  }
+  for (auto &param : params) {
+    if (!res.contains(param)) {
+      error = "Cannot infer " + param + " for " + fdecl.name + ", write " +
+              fdecl.name + "[type](...).";
+      return std::nullopt;
+    }
+  }
+  return res;
+}
+
+bool is_vector(const std::optional<ASTType> &type) {
+  return type.has_value() && type->count == 0 &&
+         vector_types.contains(type->name);
+}
+
+bool is_array(const std::optional<ASTType> &type) {
+  return type.has_value() && type->count > 0 && !type->soa;
+}
+
+bool is_numeric(const std::optional<ASTType> &type) {
+  return type.has_value() && type->count == 0 &&
+         numeric_types.contains(type->name);
+}
+
+// Type of arithmetic on two numbers, by C's usual conversions: the wider
+// float, or else integers narrower than int become int and then the wider
+// one wins, unsigned if both are as wide.
+std::string arith_type(const std::string &a, const std::string &b) {
+  auto &x = numeric_types[a], &y = numeric_types[b];
+  if (x.is_float || y.is_float) {
+    if ((x.is_float && x.bits == 64) || (y.is_float && y.bits == 64))
+      return "f64";
+    return "float";
+  }
+  std::string l = x.bits < 32 ? "int" : a, r = y.bits < 32 ? "int" : b;
+  auto &lt = numeric_types[l], &rt = numeric_types[r];
+  if (lt.bits != rt.bits)
+    return lt.bits > rt.bits ? l : r;
+  return lt.is_signed ? r : l;
+}
+
+// Calls like i64(x) convert to a numeric type.
+bool is_conversion(const ASTFuncCall &fcall) {
+  std::string name = callee_name(fcall);
+  return numeric_types.contains(canonical_type(name)) &&
+         !functions.contains(name) && !lookup_var(name);
+}
+
+// Comparing vectors gives a lane mask of the same width.
+ASTType vector_mask(const ASTType &type) {
+  return ASTType{vector_types[type.name].second == 4 ? "vec4i" : "vec8i", 0};
+}
+
+std::optional<ASTType> infer_type(const ASTOperation &op) {
+  switch (op.op) {
+  case Operator::Index: {
+    auto base = infer_type(*op.left);
+    if (is_vector(base))
+      return ASTType{vector_types[base->name].first, 0};
+    if (is_map(base) && base->count == 0)
+      return map_value(*base);
+    // Strings index to their bytes, see inn_str_at.
+    if (base.has_value() && base->name == "string" && base->count == 0)
+      return ASTType{"int", 0};
+    if (!base.has_value() || base->count == 0)
+      return std::nullopt;
+    return ASTType{base->name, 0};
+  }
+  case Operator::Ref: {
+    auto base = infer_type(*op.right);
+    if (!base.has_value() || base->count != 0)
+      return std::nullopt;
+    return ASTType{base->name, -1};
+  }
+  case Operator::Member: {
+    auto base = infer_type(*op.left);
+    if (!base.has_value() || base->count > 0)
+      return std::nullopt;
+    return field_type(*base, member_name(op));
+  }
+  case Operator::Assign:
+    return infer_type(*op.left);
+  case Operator::Spawn: {
+    auto ret = infer_type(*op.right);
+    if (!ret.has_value() || ret->count != 0)
+      return std::nullopt;
+    return ASTType{"task[" + ret->name + "]", 0};
+  }
+  case Operator::Pos:
+  case Operator::Neg:
+    return infer_type(*op.right);
+  case Operator::Add:
+  case Operator::Sub:
+  case Operator::Mul:
+  case Operator::Div:
+  case Operator::Exp: {
+    auto left = infer_type(*op.left), right = infer_type(*op.right);
+    if (is_array(left) || is_array(right)) {
+      // Whole-array arithmetic, extents are checked when it's generated.
+      auto &arr = is_array(left) ? left : right;
+      ASTType elem{arr->name, 0};
+      auto l = is_array(left) ? elem : left, r = is_array(right) ? elem : right;
+      if (is_numeric(l) && is_numeric(r))
+        return ASTType{arith_type(l->name, r->name), arr->count};
+      return ASTType{arr->name, arr->count};
+    }
+    if (is_vector(left))
+      return left;
+    if (is_vector(right))
+      return right;
+    if (!left.has_value() || !right.has_value())
+      return std::nullopt;
+    if (is_numeric(left) && is_numeric(right))
+      return ASTType{arith_type(left->name, right->name), 0};
+    return left;
+  }
+  case Operator::Equal:
+  case Operator::Greater:
+  case Operator::GreaterEq:
+  case Operator::Less:
+  case Operator::LessEq: {
+    auto left = infer_type(*op.left), right = infer_type(*op.right);
+    if (is_vector(left))
+      return vector_mask(*left);
+    if (is_vector(right))
+      return vector_mask(*right);
+    return ASTType{"int", 0};
+  }
+  default:
+    return ASTType{"int", 0};
+  }
+}
+
+std::optional<ASTType> infer_type(const Expr &ex) {
+  if (auto sing = std::get_if<ASTSingular>(&ex.value)) {
+    if (auto lit = std::get_if<ASTInt>(sing))
+      return ASTType{lit->type, 0};
+    if (auto lit = std::get_if<ASTFloat>(sing))
+      return ASTType{lit->type, 0};
+    if (std::holds_alternative<ASTString>(*sing))
+      return ASTType{"string", 0};
+    return lookup_var(std::get<ASTSymbol>(*sing).value);
+  }
+  if (auto op = std::get_if<ASTOperation>(&ex.value))
+    return infer_type(*op);
+  if (auto fcall = std::get_if<ASTFuncCall>(&ex.value)) {
+    std::string name = callee_name(*fcall);
+    auto it = functions.find(name);
+    if (it != functions.end() && is_generic(*it->second)) {
+      std::string error{};
+      auto bindings = bind_type_params(*it->second, *fcall, error);
+      if (!bindings.has_value())
+        return std::nullopt;
+      auto ret = it->second->ret;
+      auto bound = bindings->find(ret.name);
+      if (bound != bindings->end())
+        ret.name = bound->second;
+      return ret;
+    }
+    if (it != functions.end())
+      return it->second->ret;
+    if (is_conversion(*fcall))
+      return ASTType{canonical_type(name), 0};
+    if (name == "join" && fcall->args.size() == 1) {
+      auto handle = infer_type(fcall->args[0]);
+      if (is_task(handle))
+        return task_result(*handle);
+    }
+    if (builtins.contains(name) && !builtins[name].ret.name.empty())
+      return builtins[name].ret;
+    if ((name == "map_keys" || name == "map_values") &&
+        fcall->args.size() == 1) {
+      auto map = infer_type(fcall->args[0]);
+      if (is_map(map))
+        return name == "map_keys" ? map_key(*map) : map_value(*map);
+    }
+    if (name == "map_has" || name == "map_del" || name == "map_len")
+      return ASTType{"int", 0};
+    if (reductions.contains(name) && !fcall->args.empty()) {
+      if (name == "prefix_sum")
+        return ASTType{"void", 0};
+      if (name == "count_if")
+        return ASTType{"int", 0};
+      auto arr = infer_type(fcall->args[0]);
+      if (arr.has_value())
+        return ASTType{arr->name, 0};
+    }
+  }
+  return std::nullopt;
+}
+
+bool is_string(const Expr &ex) {
+  auto type = infer_type(ex);
+  return type.has_value() && type->name == "string" && type->count == 0;
+}
+
+// Literals become static constants with their length worked out up front.
+std::unordered_map<std::string, size_t> string_literals{};
+
+std::string string_initializer(const std::string &value) {
+  return "{.p = {" + quote(value) + ", " + std::to_string(value.size()) +
+         "ull | INN_STR_TERM}}";
+}
+
+std::string string_literal(const std::string &value) {
+  require_runtime("string");
+  auto it = string_literals.find(value);
+  if (it == string_literals.end())
+    it = string_literals.emplace(value, string_literals.size()).first;
+  return "inn_lit_" + std::to_string(it->second);
+}
+
+std::string generate_string_literals() {
+  std::vector<const std::string *> ordered(string_literals.size());
+  for (auto &[value, index] : string_literals)
+    ordered[index] = &value;
+  std::string res{};
+  for (size_t i = 0; i < ordered.size(); ++i)
+    res += "static const inn_str inn_lit_" + std::to_string(i) + " = " +
+           string_initializer(*ordered[i]) + ";\n";
+  return res;
+}
+
+// Literals keep the type they were written with, 255u8 is a uint8_t in C.
+std::string generate_literal(const ASTInt &lit) {
+  std::string digits = std::to_string(lit.value);
+  if (lit.type == "int")
+    return digits;
+  if (lit.type == "i64")
+    return "((int64_t)" + digits + "ll)";
+  if (lit.type == "u64")
+    return "((uint64_t)" + digits + "ull)";
+  return "((" + types[lit.type] + ")" + digits + ")";
+}
+
+// The shortest digits which read back as the same double. Unsuffixed float
+// literals are doubles in C as well, so they still round only once.
+std::string generate_literal(const ASTFloat &lit) {
+  char buf[32];
+  auto res = std::to_chars(buf, buf + sizeof(buf), lit.value);
+  std::string digits(buf, res.ptr);
+  if (digits.find_first_of(".e") == std::string::npos)
+    digits += ".0";
+  return digits;
+}
+
 std::string generate_one(const ASTSingular &sing) {
   return std::visit(
       [](auto &arg) -> std::string {
         using T = std::decay_t<decltype(arg)>;
         if constexpr (std::is_same_v<T, ASTInt>)
-          return std::to_string(arg.value);
+          return generate_literal(arg);
         if constexpr (std::is_same_v<T, ASTFloat>)
-          return std::to_string(arg.value);
+          return generate_literal(arg);
         if constexpr (std::is_same_v<T, ASTString>)
-          return quote(arg.value);
-        if constexpr (std::is_same_v<T, ASTSymbol>)
-          return arg.value;
+          return string_literal(arg.value);
+        if constexpr (std::is_same_v<T, ASTSymbol>) {
+          auto value = const_value(arg.value);
+          if (value != nullptr &&
+              !std::holds_alternative<std::vector<Value>>(value->v))
+            return c_value(*value);
+          return var_c_name(arg.value);
+        }
       },
       sing);
 }
 
 std::string generate_one(const Expr &ex);
 
-std::string generate_one(const ASTFuncCall &fcall) {
-  std::string res = "(" + generate_one(*fcall.callee) + "(";
+std::string generate_type(const ASTType &var, std::string identifier);
+
+// Expressions whose C form depends on the type they're stored into.
+std::string generate_typed(const Expr &value, const ASTType &target) {
+  auto sing = std::get_if<ASTSingular>(&value.value);
+  if (sing != nullptr && std::holds_alternative<ASTString>(*sing) &&
+      scopes.size() == 1) {
+    // File scope initializers have to be constant expressions.
+    require_runtime("string");
+    return string_initializer(std::get<ASTString>(*sing).value);
+  }
+  auto fcall = std::get_if<ASTFuncCall>(&value.value);
+  if (fcall != nullptr && is_builtin_call(*fcall, "region_array")) {
+    if (target.count != -1)
+      throw std::runtime_error("region_array must be stored into a pointer.");
+    if (fcall->args.size() != 2 && fcall->args.size() != 3)
+      throw std::runtime_error("region_array expects (region, count[, align]).");
+    require_runtime("region");
+    std::string elem = generate_type(ASTType{target.name, 0}, "");
+    std::string align = "_Alignof(" + elem + ")";
+    if (fcall->args.size() == 3)
+      align = "inn_region_align(" + generate_one(fcall->args[2]) + ", " +
+              align + ")";
+    return "((" + elem + "*)inn_region_alloc(" + generate_one(fcall->args[0]) +
+           ", (long long)(" + generate_one(fcall->args[1]) + ") * sizeof(" +
+           elem + "), " + align + "))";
+  }
+  return generate_one(value);
+}
+
+std::string generate_reduction(const ASTFuncCall &fcall,
+                               const std::string &name);
+
+std::vector<std::string> generate_args(const ASTFuncCall &fcall) {
+  std::string name = callee_name(fcall);
+  bool builtin = builtins.contains(name) && !functions.contains(name);
+  // Functions from C still get plain string literals, e.g. printf formats.
+  bool external = !builtin && !functions.contains(name) && !lookup_var(name);
+  std::vector<std::string> res{};
   for (size_t i = 0; i < fcall.args.size(); ++i) {
-    res += generate_one(fcall.args[i]);
-    if (i != fcall.args.size() - 1)
+    auto sing = std::get_if<ASTSingular>(&fcall.args[i].value);
+    if (external && sing != nullptr &&
+        std::holds_alternative<ASTString>(*sing)) {
+      res.push_back(quote(std::get<ASTString>(*sing).value));
+    } else if (builtin && i == 0 && builtins[name].by_ref) {
+      res.push_back("&" + generate_one(fcall.args[i]));
+    } else if (functions.contains(name) &&
+               i < functions[name]->args.size() &&
+               by_address(functions[name]->args[i].second)) {
+      res.push_back("&" + generate_one(fcall.args[i]));
+    } else if (is_array(infer_type(fcall.args[i])) &&
+               const_value(root_name(fcall.args[i])) != nullptr) {
+      // Arrays in static const data are passed like any other array.
+      res.push_back("((" + types[infer_type(fcall.args[i])->name] + "*)" +
+                    generate_one(fcall.args[i]) + ")");
+    } else {
+      res.push_back(generate_one(fcall.args[i]));
+    }
+  }
+  return res;
+}
+
+Evaluator evaluator{};
+
+struct Instance {
+  const ASTFuncDeclare *fdecl;
+  TypeBindings bindings;
+};
+
+// Instances of generic functions by mangled name, and their names in the
+// order they were first called.
+std::unordered_map<std::string, Instance> instances{};
+std::vector<std::string> instance_order{};
+
+std::string mangle(const ASTFuncDeclare &fdecl, const TypeBindings &bindings) {
+  std::string res = fdecl.name;
+  for (auto &param : fdecl.type_params)
+    res += "__" + bindings.at(param);
+  return res;
+}
+
+// C name of the instance a generic call needs. Each set of type arguments
+// is generated once, however many calls use it.
+std::string instantiate(const ASTFuncCall &fcall) {
+  auto &fdecl = *functions[callee_name(fcall)];
+  std::string error{};
+  auto bindings = bind_type_params(fdecl, fcall, error);
+  if (!bindings.has_value())
+    throw std::runtime_error(error);
+  std::string name = mangle(fdecl, bindings.value());
+  if (!instances.contains(name)) {
+    if (functions.contains(name))
+      throw std::runtime_error("Instance " + name + " of " + fdecl.name +
+                               " clashes with a function of that name.");
+    instances[name] = {&fdecl, bindings.value()};
+    instance_order.push_back(name);
+  }
+  return name;
+}
+
+// Task struct and the function running it, for each spawned function by its
+// C name. The struct holds the result and then the arguments.
+std::unordered_map<std::string, std::string> task_wrappers{};
+std::vector<std::string> task_wrapper_order{};
+
+std::string generate_task_wrapper(const ASTFuncDeclare &fdecl,
+                                  const std::string &name) {
+  std::string type = "inn_task_" + name;
+  if (task_wrappers.contains(name))
+    return type;
+  if (fdecl.ret.count != 0)
+    throw std::runtime_error("Spawned function " + fdecl.name +
+                             " can't return an array.");
+  bool is_void = fdecl.ret.name == "void";
+  std::string res = "typedef struct {\ninn_task base;\n";
+  if (!is_void)
+    res += generate_type(fdecl.ret, "result") + ";\n";
+  std::string call = name + "(";
+  for (size_t i = 0; i < fdecl.args.size(); ++i) {
+    ASTType field = fdecl.args[i].second;
+    if (field.soa)
+      throw std::runtime_error("soa arrays can't be passed to spawned "
+                               "function " + fdecl.name + ".");
+    // Fixed size arrays are passed as pointers either way.
+    if (field.count > 0 || by_address(field))
+      field.count = -1;
+    std::string arg = "a" + std::to_string(i);
+    if (effects.contains(fdecl.name) && effects[fdecl.name].read_only[i])
+      res += "const ";
+    res += generate_type(field, arg) + ";\n";
+    call += "c->" + arg + (i != fdecl.args.size() - 1 ? "," : "");
+  }
+  res += "} " + type + ";\n";
+  res += "static void " + type + "_run(inn_task *t) {\n" + type + " *c = (" +
+         type + " *)t;\n" + (is_void ? "" : "c->result = ") + call + ");\n}\n";
+  task_wrappers[name] = res;
+  task_wrapper_order.push_back(name);
+  return type;
+}
+
+// `spawn f(args)` copies the arguments into a task and queues it on this
+// worker, `join` waits for it and frees it.
+std::string generate_spawn(const ASTOperation &op) {
+  auto fcall = std::get_if<ASTFuncCall>(&op.right->value);
+  std::string name = fcall != nullptr ? callee_name(*fcall) : "";
+  if (fcall == nullptr || !functions.contains(name) || lookup_var(name) ||
+      functions[name]->is_gen)
+    throw std::runtime_error("spawn needs a call to an Inn function.");
+  auto &fdecl = *functions[name];
+  if (fcall->args.size() != fdecl.args.size())
+    throw std::runtime_error("Spawned call to " + name +
+                             " has the wrong number of arguments.");
+  // The wrapper is typed by the callee's bindings, not the caller's.
+  if (is_generic(fdecl))
+    name = instantiate(*fcall);
+  TypeBindings caller = type_bindings;
+  type_bindings = is_generic(fdecl) ? instances[name].bindings : TypeBindings{};
+  std::string type = generate_task_wrapper(fdecl, name);
+  type_bindings = caller;
+  require_runtime("task");
+  auto args = generate_args(*fcall);
+  std::string res = "({" + type + " *__inn_task = inn_task_alloc(sizeof(" +
+                    type + "));\n";
+  for (size_t i = 0; i < args.size(); ++i)
+    res += "__inn_task->a" + std::to_string(i) + " = " + args[i] + ";\n";
+  res += "__inn_task->base.result = ";
+  res += fdecl.ret.name == "void" ? "NULL" : "&__inn_task->result";
+  res += ";\ninn_task_spawn(&__inn_task->base, " + type + "_run);\n";
+  return res + "&__inn_task->base;})";
+}
+
+std::string generate_join(const ASTFuncCall &fcall) {
+  auto handle = fcall.args.size() == 1 ? infer_type(fcall.args[0])
+                                       : std::nullopt;
+  if (!is_task(handle))
+    throw std::runtime_error("join takes a task handle.");
+  ASTType result = task_result(*handle);
+  std::string res = "({inn_task *__inn_h = " + generate_one(fcall.args[0]) +
+                    ";\ninn_task_join(__inn_h);\n";
+  if (result.name == "void")
+    return res + "free(__inn_h);})";
+  res += generate_type(result, "__inn_r") + " = *(" +
+         generate_type(result, "") + "*)__inn_h->result;\n";
+  return res + "free(__inn_h);\n__inn_r;})";
+}
+
+// One piece of output, literal text or an argument printed as `conv` (a
+// printf conversion, 0 for whatever its type is).
+struct OutPart {
+  std::string text{};
+  const Expr *arg = nullptr;
+  char conv = 0;
+  int prec = 6;
+};
+
+std::optional<std::string> string_literal(const Expr &ex) {
+  auto sing = std::get_if<ASTSingular>(&ex.value);
+  if (sing == nullptr || !std::holds_alternative<ASTString>(*sing))
+    return std::nullopt;
+  return std::get<ASTString>(*sing).value;
+}
+
+std::string generate_out_write(const OutPart &part, const std::string &tmp) {
+  auto type = infer_type(*part.arg);
+  std::string name = type.has_value() && type->count == 0 ? type->name : "";
+  if (name == "string" && (part.conv == 0 || part.conv == 's'))
+    return "inn_out_bytes(INN_STR_DATA(" + tmp + "), inn_str_len(" + tmp +
+           "))";
+  switch (part.conv) {
+  case 's':
+    return "inn_out_cstr(" + tmp + ")";
+  case 'c':
+    return "inn_out_char(" + tmp + ")";
+  case 'd':
+    return "inn_out_int(" + tmp + ")";
+  case 'f':
+    return "inn_out_float(" + tmp + ", " + std::to_string(part.prec) + ")";
+  }
+  if (name == "u64")
+    return "inn_out_uint(" + tmp + ")";
+  if (numeric_types.contains(name) && numeric_types[name].is_float)
+    return "inn_out_float(" + tmp + ", 6)";
+  if (numeric_types.contains(name))
+    return "inn_out_int(" + tmp + ")";
+  throw std::runtime_error("print can't write values of type " +
+                           (type.has_value() ? type->name : "unknown") + ".");
+}
+
+// Arguments are all evaluated before anything is written, like for printf.
+// The result is the number of bytes written.
+std::string generate_out(const std::vector<OutPart> &parts) {
+  require_runtime("print");
+  std::string temps{}, writes{};
+  for (auto &part : parts) {
+    if (part.arg == nullptr) {
+      if (!part.text.empty())
+        writes += "__inn_n += inn_out_bytes(" + quote(part.text) + ", " +
+                  std::to_string(part.text.size()) + ");\n";
+      continue;
+    }
+    if (auto text = string_literal(*part.arg)) {
+      writes += "__inn_n += inn_out_bytes(" + quote(*text) + ", " +
+                std::to_string(text->size()) + ");\n";
+      continue;
+    }
+    OutPart arg = part;
+    // cstr only makes a copy to print, the string's bytes can be used as is.
+    auto fcall = std::get_if<ASTFuncCall>(&part.arg->value);
+    if (part.conv == 's' && fcall != nullptr && callee_name(*fcall) == "cstr" &&
+        !functions.contains("cstr") && fcall->args.size() == 1 &&
+        is_string(fcall->args[0]))
+      arg.arg = &fcall->args[0];
+    std::string tmp = "__inn_p" + std::to_string(&part - parts.data());
+    temps += "__auto_type " + tmp + " = " + generate_one(*arg.arg) + ";\n";
+    writes += "__inn_n += " + generate_out_write(arg, tmp) + ";\n";
+  }
+  return "({int __inn_n = 0;\n" + temps + writes + "inn_out_done(__inn_n);})";
+}
+
+// printf with a constant format is split while compiling. Formats using
+// anything beyond %d, %i, %c, %s, %f and %.Nf are left to printf.
+std::optional<std::string> lower_printf(const ASTFuncCall &fcall) {
+  auto format = fcall.args.empty() ? std::nullopt
+                                   : string_literal(fcall.args[0]);
+  if (!format.has_value())
+    return std::nullopt;
+  auto &fmt = *format;
+  std::vector<OutPart> parts{};
+  std::string text{};
+  size_t next = 1;
+  for (size_t i = 0; i < fmt.size(); ++i) {
+    if (fmt[i] != '%') {
+      text += fmt[i];
+      continue;
+    }
+    if (++i < fmt.size() && fmt[i] == '%') {
+      text += '%';
+      continue;
+    }
+    OutPart part{};
+    bool has_prec = i < fmt.size() && fmt[i] == '.';
+    if (has_prec) {
+      size_t digits = ++i;
+      while (i < fmt.size() && isdigit(fmt[i]))
+        ++i;
+      if (i == digits || i - digits > 2)
+        return std::nullopt;
+      part.prec = std::stoi(fmt.substr(digits, i - digits));
+    }
+    int longs = 0;
+    while (i < fmt.size() && fmt[i] == 'l')
+      ++i, ++longs;
+    if (i >= fmt.size() || next >= fcall.args.size())
+      return std::nullopt;
+    part.conv = fmt[i] == 'i' ? 'd' : fmt[i];
+    if (std::string("dcsf").find(part.conv) == std::string::npos ||
+        (has_prec && part.conv != 'f') || longs > 2 ||
+        (longs > 0 && part.conv != 'd'))
+      return std::nullopt;
+    part.arg = &fcall.args[next++];
+    parts.push_back({text});
+    parts.push_back(part);
+    text.clear();
+  }
+  if (next != fcall.args.size())
+    return std::nullopt;
+  parts.push_back({text});
+  return generate_out(parts);
+}
+
+std::string generate_print(const ASTFuncCall &fcall, bool newline) {
+  std::vector<OutPart> parts{};
+  for (auto &arg : fcall.args)
+    parts.push_back({"", &arg});
+  if (newline)
+    parts.push_back({"\n"});
+  return generate_out(parts);
+}
+
+// C functions writing to stdout, which have to come after buffered prints.
+std::unordered_set<std::string> stdout_functions{"printf", "puts", "putchar",
+                                                 "vprintf"};
+
+// Result of a call to a const func, if its arguments are constant here.
+std::optional<Value> fold_call(const ASTFuncCall &fcall) {
+  std::string name = callee_name(fcall);
+  auto it = functions.find(name);
+  if (it == functions.end() || !it->second->is_const || lookup_var(name))
+    return std::nullopt;
+  try {
+    return evaluator.eval_call(fcall);
+  } catch (const EvalError &) {
+    return std::nullopt; // Called at run time instead
+  }
+}
+
+// Const funcs returning arrays only exist while compiling.
+bool compile_time_only(const ASTFuncDeclare &fdecl) {
+  return fdecl.is_const && fdecl.ret.count != 0;
+}
+
+std::string map_type_name(const ASTType &var);
+
+// Map builtins call the operation of the same name on the map's type, with
+// the map passed by address.
+std::string generate_map_call(const ASTFuncCall &fcall,
+                              const std::string &name) {
+  auto map = fcall.args.empty() ? std::nullopt : infer_type(fcall.args[0]);
+  if (!is_map(map) || map->count != 0 ||
+      fcall.args.size() != map_builtins[name]) {
+    std::string params = map_builtins[name] == 1   ? ""
+                         : name == "map_reserve" ? ", count"
+                                                 : ", key";
+    throw std::runtime_error(name + " expects (map" + params + ").");
+  }
+  if (name == "map_keys" || name == "map_values")
+    throw std::runtime_error(name + " runs in a for ... in loop.");
+  std::string res = "(" + map_type_name(*map) + "_" + name.substr(4) + "(&" +
+                    generate_one(fcall.args[0]);
+  if (name == "map_reserve")
+    res += ", " + generate_one(fcall.args[1]);
+  else if (fcall.args.size() == 2)
+    res += ", " + generate_typed(fcall.args[1], map_key(*map));
+  return res + "))";
+}
+
+std::string generate_one(const ASTFuncCall &fcall) {
+  std::string name = callee_name(fcall);
+  if (auto value = fold_call(fcall)) {
+    if (std::holds_alternative<std::vector<Value>>(value->v))
+      throw std::runtime_error(name + " returns an array, store it in a "
+                               "var or const.");
+    return "(" + c_value(value.value()) + ")";
+  }
+  if (functions.contains(name) && compile_time_only(*functions[name]) &&
+      !lookup_var(name))
+    throw std::runtime_error(name + " returns an array, so its arguments "
+                             "have to be constants.");
+  if (functions.contains(name) && functions[name]->is_gen && !lookup_var(name))
+    throw std::runtime_error("Generator " + name + " runs in a for ... in "
+                             "loop.");
+  if (reductions.contains(name) && !functions.contains(name))
+    return generate_reduction(fcall, name);
+  if (is_conversion(fcall)) {
+    if (fcall.args.size() != 1)
+      throw std::runtime_error(name + "(...) converts a single value.");
+    return "((" + types[canonical_type(name)] + ")(" +
+           generate_one(fcall.args[0]) + "))";
+  }
+  if (name == "join" && !functions.contains(name))
+    return generate_join(fcall);
+  if (map_builtins.contains(name) && !functions.contains(name))
+    return generate_map_call(fcall, name);
+  if ((name == "print" || name == "println") && !functions.contains(name))
+    return generate_print(fcall, name == "println");
+  bool to_stdout = stdout_functions.contains(name) &&
+                   !functions.contains(name) && !lookup_var(name);
+  if (name == "printf" && to_stdout)
+    if (auto lowered = lower_printf(fcall))
+      return lowered.value();
+  if (name == "region_array" && !functions.contains(name))
+    throw std::runtime_error("region_array needs a typed destination, store "
+                             "it into a variable.");
+  if (name == "cstr" && fcall.args.size() == 1 && !functions.contains(name)) {
+    auto sing = std::get_if<ASTSingular>(&fcall.args[0].value);
+    if (sing != nullptr && std::holds_alternative<ASTString>(*sing))
+      return quote(std::get<ASTString>(*sing).value);
+    // The copy lives in a buffer owned by this call, see inn_cstr.
+    require_runtime("string");
+    return "({static _Thread_local inn_cstr_buf __inn_cb; inn_cstr(&__inn_cb, " +
+           generate_one(fcall.args[0]) + ");})";
+  }
+  if ((name.ends_with("_load") || name.ends_with("_store")) &&
+      vector_types.contains(name.substr(0, 5)) && !functions.contains(name) &&
+      !fcall.args.empty()) {
+    auto arr = infer_type(fcall.args[0]);
+    auto &lane = vector_types[name.substr(0, 5)].first;
+    if (arr.has_value() && (arr->count == 0 || arr->name != lane))
+      throw std::runtime_error(name + " works on arrays of " + lane + ".");
+  }
+  std::string callee{};
+  if (functions.contains(name) && is_generic(*functions[name]) &&
+      !lookup_var(name))
+    callee = instantiate(fcall);
+  else
+    callee = generate_one(*fcall.callee);
+  if (builtins.contains(name) && !functions.contains(name)) {
+    require_runtime(builtins[name].module);
+    callee = builtins[name].c_name;
+  }
+  std::string res = "(" + callee + "(";
+  auto args = generate_args(fcall);
+  for (size_t i = 0; i < args.size(); ++i) {
+    res += args[i];
+    if (i != args.size() - 1)
       res += ",";
   }
   res += "))";
+  if (to_stdout) {
+    require_runtime("print");
+    return "(inn_out_sync(), " + res + ")";
+  }
   return res;
 }
 
+void flatten_concat(const Expr &ex, std::vector<const Expr *> &parts) {
+  auto op = std::get_if<ASTOperation>(&ex.value);
+  if (op != nullptr && op->op == Operator::Add && is_string(ex)) {
+    flatten_concat(*op->left, parts);
+    flatten_concat(*op->right, parts);
+  } else {
+    parts.push_back(&ex);
+  }
+}
+
+// a + b + c on strings makes a single allocation for the whole result, or
+// reuses `owner`'s buffer when it's stored into a variable owning one.
+std::string generate_concat(const ASTOperation &op,
+                            const std::string &owner = "") {
+  std::vector<const Expr *> parts{};
+  flatten_concat(*op.left, parts);
+  flatten_concat(*op.right, parts);
+  std::string res = (owner.empty() ? "(inn_str_concat_n("
+                                   : "(inn_str_concat_owned(&" + owner + ", ") +
+                    std::to_string(parts.size()) + ", (inn_str[]){";
+  for (size_t i = 0; i < parts.size(); ++i) {
+    res += generate_one(*parts[i]);
+    if (i != parts.size() - 1)
+      res += ",";
+  }
+  return res + "}))";
+}
+
 std::string generate_one(const ASTArray &arr) {
   std::string res = "{";
   for (size_t i = 0; i < arr.values.size(); ++i) {
@@ -72,12 +1160,43 @@ std::string generate_one(const ASTArray &arr) {
   return res;
 }
 
-std::string generate_one(const ASTOperation &op) {
-  std::string left{}, right{};
-  if (op.left != nullptr)
-    left = generate_one(*op.left);
-  if (op.right != nullptr)
-    right = generate_one(*op.right);
+// Element i of an soa array, or nullptr if `ex` isn't one.
+const ASTOperation *soa_element(const Expr &ex) {
+  auto op = std::get_if<ASTOperation>(&ex.value);
+  if (op == nullptr || op->op != Operator::Index || op->right == nullptr)
+    return nullptr;
+  auto base = infer_type(*op->left);
+  return base.has_value() && base->soa ? op : nullptr;
+}
+
+std::string generate_member(const ASTOperation &op) {
+  std::string field = member_name(op);
+  if (auto elem = soa_element(*op.left))
+    return "(" + generate_one(*elem->left) + "." + field + "[" +
+           generate_one(*elem->right) + "])";
+  auto base = infer_type(*op.left);
+  if (base.has_value() && base->count == -1)
+    return "(" + generate_one(*op.left) + "->" + field + ")";
+  return "(" + generate_one(*op.left) + "." + field + ")";
+}
+
+// Reading a whole soa element gathers its fields back into a struct.
+std::string generate_soa_element(const ASTOperation &elem) {
+  auto base = infer_type(*elem.left);
+  std::string arr = generate_one(*elem.left);
+  std::string idx = generate_one(*elem.right);
+  std::string res = "((" + base->name + "){";
+  auto &fields = structs[base->name]->fields;
+  for (size_t i = 0; i < fields.size(); ++i) {
+    res += arr + "." + fields[i].first + "[" + idx + "]";
+    if (i != fields.size() - 1)
+      res += ",";
+  }
+  return res + "})";
+}
+
+std::string generate_binary(const ASTOperation &op, const std::string &left,
+                            const std::string &right) {
   switch (op.op) {
   case Operator::Add:
     return "(" + left + "+" + right + ")";
@@ -124,56 +1243,743 @@ std::string generate_one(const ASTOperation &op) {
   throw "unreachable";
 }
 
-std::string generate_one(const Expr &ex) {
-  return std::visit([](auto &arg) -> std::string { return generate_one(arg); },
-                    ex.value);
+bool is_arithmetic(Operator op) {
+  return op == Operator::Add || op == Operator::Sub || op == Operator::Mul ||
+         op == Operator::Div || op == Operator::Exp || op == Operator::Pos ||
+         op == Operator::Neg;
 }
 
-std::string generate_one(const Statement &stmt);
+// Operators applied element by element when their operands are arrays.
+bool is_elementwise(Operator op) {
+  return is_arithmetic(op) || op == Operator::Equal ||
+         op == Operator::Greater || op == Operator::GreaterEq ||
+         op == Operator::Less || op == Operator::LessEq ||
+         op == Operator::And || op == Operator::Or || op == Operator::Not;
+}
 
-std::unordered_map<std::string, std::string> types{
-    {"int", "int"}, {"float", "float"}, {"string", "char*"}};
+// Whether `ex` reads elements of an array, or of a pointer if `pointers`.
+bool reads_elements(const Expr &ex, bool pointers) {
+  auto op = std::get_if<ASTOperation>(&ex.value);
+  if (op != nullptr && is_elementwise(op->op))
+    return (op->left != nullptr && reads_elements(*op->left, pointers)) ||
+           (op->right != nullptr && reads_elements(*op->right, pointers));
+  auto type = infer_type(ex);
+  return is_array(type) ||
+         (pointers && type.has_value() && type->count == -1);
+}
 
-std::string generate_type(const ASTType &var, std::string identifier) {
-  std::string res{};
-  res += types[var.name] + " "; // Assume exists I guess
-  if (var.count == -1)
-    res += "*";
-  res += identifier;
-  if (var.count > 0) {
-    res += "[" + std::to_string(var.count) + "]";
+// Extent of the first array read by `ex`, 0 if there's none.
+int array_extent(const Expr &ex) {
+  auto op = std::get_if<ASTOperation>(&ex.value);
+  if (op != nullptr && is_elementwise(op->op)) {
+    int extent = op->left != nullptr ? array_extent(*op->left) : 0;
+    return extent != 0 || op->right == nullptr ? extent
+                                               : array_extent(*op->right);
   }
-  return res;
+  auto type = infer_type(ex);
+  return is_array(type) ? type->count : 0;
 }
 
-std::string generate_one(const ASTVarDeclare &decl) {
-  std::string res{};
-  res += generate_type(decl.type, decl.name);
-  if (decl.value.has_value()) {
-    res += "=" + generate_one(decl.value.value()) + ";\n";
+// Element `idx` of an array valued expression. Scalar operands are left as
+// they are, so they apply to every element. An extent of -1 also indexes
+// pointers, whose length is only known at run time.
+std::string generate_element(const Expr &ex, int extent,
+                             const std::string &idx) {
+  if (!reads_elements(ex, extent < 0))
+    return generate_one(ex);
+  auto op = std::get_if<ASTOperation>(&ex.value);
+  if (op != nullptr && is_elementwise(op->op)) {
+    std::string left{}, right{};
+    if (op->left != nullptr)
+      left = generate_element(*op->left, extent, idx);
+    if (op->right != nullptr)
+      right = generate_element(*op->right, extent, idx);
+    return generate_binary(*op, left, right);
   }
-  return res;
+  auto type = infer_type(ex);
+  if (extent > 0 && type->count != extent)
+    throw std::runtime_error("Array extents differ, " +
+                             std::to_string(type->count) + " and " +
+                             std::to_string(extent) + ".");
+  return "(" + generate_one(ex) + "[" + idx + "])";
 }
 
-std::string generate_one(const ASTIf &stmt) {
-  std::string res{};
-  res += "if (" + generate_one(stmt.branches[0].first) + ") {\n";
-  for (auto &s : stmt.branches[0].second) {
-    res += generate_one(s);
+// Whether `ex` reads the variable `name`, or calls something that could.
+bool mentions(const Expr &ex, const std::string &name) {
+  if (auto arr = std::get_if<ASTArray>(&ex.value))
+    return std::any_of(arr->values.begin(), arr->values.end(),
+                       [&](auto &value) { return mentions(value, name); });
+  if (auto op = std::get_if<ASTOperation>(&ex.value)) {
+    if (op->op == Operator::Member)
+      return mentions(*op->left, name);
+    return (op->left != nullptr && mentions(*op->left, name)) ||
+           (op->right != nullptr && mentions(*op->right, name));
   }
-  res += "}";
-  for (size_t i = 1; i < stmt.branches.size(); ++i) {
-    res += "else if (" + generate_one(stmt.branches[i].first) + ") {\n";
-    for (auto &s : stmt.branches[i].second) {
-      res += generate_one(s);
-    }
+  if (auto fcall = std::get_if<ASTFuncCall>(&ex.value)) {
+    std::string callee = callee_name(*fcall);
+    if (callee.empty())
+      return true;
+    auto it = effects.find(callee);
+    if (functions.contains(callee) &&
+        (it == effects.end() || it->second.purity != Purity::Const))
+      return true;
+    return std::any_of(fcall->args.begin(), fcall->args.end(),
+                       [&](auto &arg) { return mentions(arg, name); });
+  }
+  return symbol_name(ex) == name;
+}
+
+// Whether the elements of `ex` can be stored into `target` as they're
+// computed, which needs the target's variable `root` to be read only at the
+// element being stored. a = a * 2.0 can, a = a[0] + a can't.
+bool fuses_into(const Expr &ex, int extent, const std::string &target,
+                const std::string &root) {
+  if (root.empty())
+    return false;
+  auto op = std::get_if<ASTOperation>(&ex.value);
+  if (reads_elements(ex, extent < 0) && op != nullptr &&
+      is_elementwise(op->op))
+    return (op->left == nullptr ||
+            fuses_into(*op->left, extent, target, root)) &&
+           (op->right == nullptr ||
+            fuses_into(*op->right, extent, target, root));
+  if (reads_elements(ex, extent < 0) && generate_one(ex) == target)
+    return true;
+  return !mentions(ex, root);
+}
+
+// Assigning to a whole array is a single loop over its elements, so chains
+// of arithmetic are fused and need no temporaries. Each element only depends
+// on the same element of its operands, which ivdep tells the C compiler.
+// When `lvalue` is read some other way, the loop fills a temporary that's
+// copied over it afterwards.
+std::string generate_array_assign(const std::string &target,
+                                  const ASTType &type, const Expr &value,
+                                  const Expr *lvalue = nullptr) {
+  std::string n = std::to_string(type.count);
+  if (lvalue != nullptr &&
+      !fuses_into(value, type.count, target, root_name(*lvalue)))
+    return "{\n__typeof__(" + target + "[0]) __inn_a[" + n + "];\n" +
+           generate_array_assign("__inn_a", type, value) +
+           "__builtin_memcpy(" + target + ", __inn_a, sizeof(__inn_a));\n}\n";
+  return "#pragma GCC ivdep\nfor (int __inn_i = 0; __inn_i < " + n +
+         "; ++__inn_i) " + target + "[__inn_i] = " +
+         generate_element(value, type.count, "__inn_i") + ";\n";
+}
+
+// count_if(xs > 0.5) counts the elements a condition holds for, in one loop
+// over the arrays it reads. Pointers need a length, count_if(p > 0.5, n).
+std::string generate_count_if(const ASTFuncCall &fcall) {
+  if (fcall.args.size() != 1 && fcall.args.size() != 2)
+    throw std::runtime_error("count_if expects a condition and an optional "
+                             "length.");
+  auto &cond = fcall.args[0];
+  bool pointers = fcall.args.size() == 2;
+  if (!reads_elements(cond, pointers))
+    throw std::runtime_error("count_if needs a condition on arrays.");
+  int extent = pointers ? -1 : array_extent(cond);
+  std::string length = pointers ? generate_one(fcall.args[1])
+                                 : std::to_string(extent);
+  return "({int __inn_n = 0; for (long long __inn_i = 0; __inn_i < " +
+         length + "; ++__inn_i) __inn_n += (" +
+         generate_element(cond, extent, "__inn_i") + ") != 0; __inn_n;})";
+}
+
+// The other reductions call the runtime version for their element type.
+std::string generate_reduction(const ASTFuncCall &fcall,
+                               const std::string &name) {
+  if (name == "count_if")
+    return generate_count_if(fcall);
+  size_t arrays = reductions[name];
+  if (fcall.args.size() != arrays && fcall.args.size() != arrays + 1)
+    throw std::runtime_error(name + " expects " +
+                             (arrays == 1 ? "an array" : "two arrays") +
+                             " and an optional length.");
+  std::string elem{}, length{}, res{};
+  for (size_t i = 0; i < arrays; ++i) {
+    auto type = infer_type(fcall.args[i]);
+    if (!type.has_value() || type->count == 0 || type->soa ||
+        (type->name != "int" && type->name != "float"))
+      throw std::runtime_error(name + " works on arrays of int or float.");
+    if (!elem.empty() && type->name != elem)
+      throw std::runtime_error(name + " needs arrays of one element type.");
+    elem = type->name;
+    if (type->count > 0) {
+      std::string extent = std::to_string(type->count);
+      if (!length.empty() && length != extent)
+        throw std::runtime_error("Array extents differ, " + length + " and " +
+                                 extent + ".");
+      length = extent;
+    }
+    res += generate_one(fcall.args[i]) + ", ";
+  }
+  if (fcall.args.size() > arrays)
+    length = generate_one(fcall.args.back());
+  else if (length.empty())
+    throw std::runtime_error(name + " on a pointer needs a length.");
+  require_runtime("simd");
+  require_runtime("reduce");
+  return "(inn_" + name + "_" + (elem == "float" ? "f" : "i") + "(" + res +
+         "(long long)(" + length + ")))";
+}
+
+// m[k] of a map m, or nullptr if `ex` isn't one.
+const ASTOperation *map_entry(const Expr &ex) {
+  auto op = std::get_if<ASTOperation>(&ex.value);
+  if (op == nullptr || op->op != Operator::Index || op->right == nullptr)
+    return nullptr;
+  auto base = infer_type(*op->left);
+  return is_map(base) && base->count == 0 ? op : nullptr;
+}
+
+bool is_arithmetic(Operator op);
+
+// Whether evaluating `ex` changes nothing, so it can't move map entries.
+bool inert(const Expr &ex) {
+  if (std::holds_alternative<ASTFuncCall>(ex.value))
+    return false;
+  if (auto arr = std::get_if<ASTArray>(&ex.value))
+    return std::all_of(arr->values.begin(), arr->values.end(),
+                       [](auto &value) { return inert(value); });
+  auto op = std::get_if<ASTOperation>(&ex.value);
+  if (op == nullptr)
+    return true;
+  if (op->op == Operator::Assign || op->op == Operator::Spawn)
+    return false;
+  return (op->left == nullptr || inert(*op->left)) &&
+         (op->right == nullptr || inert(*op->right));
+}
+
+// Reading a missing key gives a zero value without adding it. Assigning
+// evaluates the value first, as it may change the map too, except for
+// updates like m[k] = m[k] + 1, which find the entry once.
+std::string generate_map_entry(const ASTOperation &entry,
+                               const Expr *value = nullptr) {
+  ASTType map = infer_type(*entry.left).value();
+  std::string type = map_type_name(map);
+  std::string target = "&" + generate_one(*entry.left);
+  std::string key = generate_typed(*entry.right, map_key(map));
+  if (value == nullptr)
+    return "(" + type + "_get(" + target + ", " + key + "))";
+  auto update = std::get_if<ASTOperation>(&value->value);
+  auto same = update != nullptr && is_arithmetic(update->op)
+                  ? map_entry(*update->left)
+                  : nullptr;
+  if (same != nullptr && is_numeric(map_value(map)) && inert(*entry.left) &&
+      inert(*entry.right) && inert(*update->right) &&
+      "&" + generate_one(*same->left) == target &&
+      generate_typed(*same->right, map_key(map)) == key)
+    return "({" + generate_type(map_value(map), "*__inn_p") + " = " + type +
+           "_put(" + target + ", " + key + ");\n*__inn_p = " +
+           generate_binary(*update, "(*__inn_p)",
+                           generate_one(*update->right)) +
+           ";})";
+  return "({" + generate_type(map_value(map), "__inn_v") + " = " +
+         generate_typed(*value, map_value(map)) + ";\n*" + type + "_put(" +
+         target + ", " + key + ") = __inn_v;})";
+}
+
+std::string generate_one(const ASTOperation &op) {
+  if (op.op == Operator::Spawn)
+    return generate_spawn(op);
+  if (op.op == Operator::Assign || op.op == Operator::Ref) {
+    // Entries move as the map grows, so there are no pointers into them.
+    auto &target = op.op == Operator::Assign ? *op.left : *op.right;
+    for (auto part = &target;;) {
+      auto inner = std::get_if<ASTOperation>(&part->value);
+      if (inner == nullptr || (inner->op != Operator::Index &&
+                               inner->op != Operator::Member))
+        break;
+      if (map_entry(*part) && op.op == Operator::Ref)
+        throw std::runtime_error("Map entries can't be referenced, they "
+                                 "move as the map grows.");
+      if (map_entry(*part) && part != &target)
+        throw std::runtime_error("Map entries can only be assigned whole, "
+                                 "as m[k] = v.");
+      part = inner->left.get();
+    }
+  }
+  if (op.op == Operator::Assign) {
+    if (auto entry = map_entry(*op.left))
+      return generate_map_entry(*entry, op.right.get());
+    auto type = infer_type(*op.left);
+    if (is_map(type) && type->count == 0 &&
+        !std::holds_alternative<ASTFuncCall>(op.right->value))
+      throw std::runtime_error("Maps can't be copied, pass them to functions "
+                               "instead.");
+  }
+  if (op.op == Operator::Index && op.right != nullptr) {
+    auto base = infer_type(*op.left);
+    if (is_map(base) && base->count == 0)
+      return generate_map_entry(op);
+  }
+  if (op.op == Operator::Assign || op.op == Operator::Ref) {
+    auto &target = op.op == Operator::Assign ? *op.left : *op.right;
+    std::string root = root_name(target);
+    if (!root.empty() && const_value(root) != nullptr)
+      throw std::runtime_error("Const " + root + " can't be " +
+                               (op.op == Operator::Assign ? "assigned to."
+                                                          : "referenced."));
+  }
+  if (op.op == Operator::Assign) {
+    std::string name = symbol_name(*op.left), owner = string_owner(name);
+    auto value = std::get_if<ASTOperation>(&op.right->value);
+    if (!owner.empty() && value != nullptr && value->op == Operator::Add &&
+        is_string(*value->left))
+      return "(" + var_c_name(name) + "=" + generate_concat(*value, owner) +
+             ")";
+  }
+  if (op.op == Operator::Member)
+    return generate_member(op);
+  if (is_arithmetic(op.op) && is_array(infer_type(op)))
+    throw std::runtime_error("Array arithmetic has to be assigned to an "
+                             "array.");
+  if (op.op == Operator::Assign && soa_element(*op.left))
+    throw std::runtime_error("Elements of soa arrays are assigned one field "
+                             "at a time.");
+  if (op.op == Operator::Index && op.right != nullptr) {
+    auto base = infer_type(*op.left);
+    if (base.has_value() && base->soa)
+      return generate_soa_element(op);
+  }
+  if (op.op == Operator::Add && is_string(*op.left))
+    return generate_concat(op);
+  if (op.op == Operator::Equal && is_string(*op.left) && is_string(*op.right))
+    return "(inn_str_eq(" + generate_one(*op.left) + "," +
+           generate_one(*op.right) + "))";
+  if (op.op == Operator::Index && op.right != nullptr && is_string(*op.left))
+    return "(inn_str_at(" + generate_one(*op.left) + "," +
+           generate_one(*op.right) + "))";
+  std::string left{}, right{};
+  if (op.left != nullptr)
+    left = generate_one(*op.left);
+  if (op.left != nullptr && op.right != nullptr && op.op != Operator::Assign &&
+      op.op != Operator::Index) {
+    // Scalars mixed with vectors are broadcast, which needs the lane type.
+    auto ltype = infer_type(*op.left), rtype = infer_type(*op.right);
+    if (is_vector(ltype) && !is_vector(rtype))
+      return generate_binary(op, left,
+                             "((" + vector_types[ltype->name].first + ")" +
+                                 generate_one(*op.right) + ")");
+    if (is_vector(rtype) && !is_vector(ltype))
+      return generate_binary(op,
+                             "((" + vector_types[rtype->name].first + ")" +
+                                 left + ")",
+                             generate_one(*op.right));
+  }
+  if (op.op == Operator::Assign) {
+    auto target = infer_type(*op.left);
+    right = target.has_value() ? generate_typed(*op.right, target.value())
+                               : generate_one(*op.right);
+  } else if (op.right != nullptr) {
+    right = generate_one(*op.right);
+  }
+  return generate_binary(op, left, right);
+}
+
+std::string generate_one(const Expr &ex) {
+  return std::visit([](auto &arg) -> std::string { return generate_one(arg); },
+                    ex.value);
+}
+
+std::string generate_one(const Statement &stmt);
+
+// Name and definition of every soa array type, in order of first use.
+std::vector<std::pair<std::string, std::string>> soa_typedefs{};
+
+// Each soa array type becomes a struct with one array per field.
+std::string soa_type_name(const ASTType &var) {
+  std::string name = "inn_soa_" + var.name + "_" + std::to_string(var.count);
+  for (auto &def : soa_typedefs)
+    if (def.first == name)
+      return name;
+  auto it = structs.find(var.name);
+  if (it == structs.end())
+    throw std::runtime_error("soa arrays need a struct element type, got " +
+                             var.name + ".");
+  std::string def = "typedef struct {\n";
+  for (auto &field : it->second->fields) {
+    if (field.second.count != 0)
+      throw std::runtime_error("soa struct " + var.name +
+                               " can only have scalar fields.");
+    def += generate_type(ASTType{field.second.name, var.count}, field.first) +
+           ";\n";
+  }
+  soa_typedefs.push_back({name, def + "} " + name + ";\n"});
+  return name;
+}
+
+// Name and operations of every map type, in order of first use. Each is
+// the runtime's table specialized to its keys and values.
+std::vector<std::pair<std::string, std::string>> map_typedefs{};
+
+std::string map_type_name(const ASTType &var) {
+  ASTType key = map_key(var), value = map_value(var);
+  std::string name = "inn_map_" + key.name + "_" + value.name;
+  for (auto &def : map_typedefs)
+    if (def.first == name)
+      return name;
+  bool string_key = key.name == "string";
+  if (!string_key && (!numeric_types.contains(key.name) ||
+                      numeric_types[key.name].is_float))
+    throw std::runtime_error("Map keys have to be integers or strings, got " +
+                             key.name + ".");
+  if (value.name == "void" || (!types.contains(value.name) && !is_task(value)))
+    throw std::runtime_error("Maps can't hold values of type " + value.name +
+                             ".");
+  require_runtime("map");
+  std::string def = "INN_MAP_FUNCS(" + name + ", " + generate_type(key, "") +
+                    ", " + generate_type(value, "") + ", " +
+                    (string_key ? "inn_str_hash, inn_str_eq"
+                                : "inn_map_hash_int, inn_map_eq_int") +
+                    ")\n";
+  map_typedefs.push_back({name, def});
+  return name;
+}
+
+std::string generate_type(const ASTType &type, std::string identifier) {
+  ASTType var = resolve_type(type);
+  if (var.soa)
+    return soa_type_name(var) + " " + identifier;
+  if (is_task(var)) {
+    require_runtime("task");
+    return "inn_task *" + identifier;
+  }
+  std::string res{};
+  if (type_modules.contains(var.name))
+    require_runtime(type_modules[var.name]);
+  if (is_map(var))
+    res += map_type_name(var) + " ";
+  else
+    res += types[var.name] + " "; // Assume exists I guess
+  if (var.count == -1)
+    res += "*";
+  res += identifier;
+  if (var.count > 0) {
+    res += "[" + std::to_string(var.count) + "]";
+  }
+  return res;
+}
+
+// A generator is a struct holding its parameters and every local that has
+// to live across a yield, and a function which runs it from where it last
+// stopped to its next yield.
+struct Generator {
+  std::string fields{};              // Members after the state
+  size_t resumes = 0;                // Yields, each a place to resume at
+  size_t locals = 0;                 // Numbers the fields of locals
+  std::vector<std::string> embeds{}; // Generators whose state is a field
+  std::string release{};             // Frees its heap arrays and embeds'
+  std::string def{};                 // Struct and prototype
+};
+
+// Generators by C name in the order they were generated, and the one being
+// generated, if any.
+std::unordered_map<std::string, Generator> generators{};
+std::vector<std::string> generator_order{};
+Generator *current_gen = nullptr;
+
+// Adds a field for a local of the current generator, returning its C name.
+// Locals are numbered, so shadowed ones get their own.
+std::string gen_field(const std::string &name, const ASTType &type) {
+  std::string field = name + "_" + std::to_string(current_gen->locals++);
+  current_gen->fields += generate_type(type, field) + ";\n";
+  return "__inn_g->" + field;
+}
+
+long long type_size(const ASTType &type);
+
+// Declaring a local of a generator only assigns its field. Arrays are
+// copied in from a compound literal. Those over the stack limit are
+// allocated the first time their declaration runs and freed with the
+// generator's state, see generate_generator.
+std::string generate_gen_local(const ASTVarDeclare &decl) {
+  std::string target{}, res{};
+  if (decl.type.count > 0 && !(decl.type.soa && decl.value.has_value()) &&
+      type_size(decl.type) > codegen_options.stack_array_limit) {
+    require_runtime("heap");
+    std::string field = decl.name + "_" + std::to_string(current_gen->locals++);
+    std::string ptr = "__inn_g->" + field;
+    current_gen->fields += generate_type(decl.type, "(*" + field + ")") + ";\n";
+    current_gen->release += "free(" + ptr + ");\n" + ptr + " = NULL;\n";
+    target = "(*" + ptr + ")";
+    res = "if (!" + ptr + ")\n" + ptr + " = inn_heap_alloc(sizeof(" + target +
+          "));\n";
+  } else {
+    target = gen_field(decl.name, decl.type);
+  }
+  ASTType type = resolve_type(decl.type);
+  auto fcall = decl.value.has_value()
+                   ? std::get_if<ASTFuncCall>(&decl.value->value)
+                   : nullptr;
+  auto folded = fcall != nullptr && is_array(type) ? fold_call(*fcall)
+                                                   : std::nullopt;
+  std::string init{};
+  if (folded.has_value()) {
+    try {
+      init = c_value(convert(folded.value(), type));
+    } catch (const EvalError &e) {
+      throw std::runtime_error("Cannot initialize " + decl.name + ": " +
+                               e.what());
+    }
+  } else if (decl.value.has_value() && is_array(type) &&
+             std::holds_alternative<ASTArray>(decl.value->value)) {
+    init = generate_one(decl.value.value());
+  }
+  if (!init.empty())
+    res += "__builtin_memcpy(" + target + ", (" + generate_type(type, "") +
+          ")" + init + ", sizeof(" + target + "));\n";
+  else if (decl.value.has_value() && is_array(type))
+    res += generate_array_assign(target, type, decl.value.value());
+  else if (decl.value.has_value())
+    res += target + " = " + generate_typed(decl.value.value(), type) + ";\n";
+  else if (type_modules.contains(type.name) || is_map(type))
+    res += "__builtin_memset(&" + target + ", 0, sizeof(" + target + "));\n";
+  declare_var(decl.name, decl.type, target);
+  return res;
+}
+
+// Function whose body is being generated, and where its scopes start.
+const ASTFuncDeclare *current_function = nullptr;
+size_t function_scope = 0;
+
+std::string generate_static(const ASTVarDeclare &decl, Value value) {
+  std::string res = "static const " + generate_type(decl.type, decl.name) +
+                    " = " + c_value(value) + ";\n";
+  declare_var(decl.name, decl.type);
+  scopes.back().consts[decl.name] = std::move(value);
+  return res;
+}
+
+// Constants are computed while compiling and become static data.
+std::string generate_const(const ASTVarDeclare &decl) {
+  Value value{};
+  try {
+    value = convert(evaluator.eval_const(decl.value.value()),
+                    resolve_type(decl.type));
+  } catch (const EvalError &e) {
+    throw std::runtime_error("Cannot compute const " + decl.name + ": " +
+                             e.what());
+  }
+  return generate_static(decl, std::move(value));
+}
+
+// The value of an array initialized from a literal or a const func, if it's
+// known while compiling.
+std::optional<Value> constant_init(const ASTVarDeclare &decl) {
+  auto &value = decl.value.value();
+  try {
+    if (auto fcall = std::get_if<ASTFuncCall>(&value.value)) {
+      if (auto folded = fold_call(*fcall))
+        return convert(folded.value(), resolve_type(decl.type));
+    } else if (std::holds_alternative<ASTArray>(value.value)) {
+      return convert(evaluator.eval_const(value), resolve_type(decl.type));
+    }
+  } catch (const EvalError &) {
+  }
+  return std::nullopt;
+}
+
+// Bytes a value takes, not counting padding.
+long long type_size(const ASTType &type) {
+  ASTType var = resolve_type(type);
+  long long size = 8;
+  if (numeric_types.contains(var.name))
+    size = numeric_types[var.name].bits / 8;
+  else if (vector_types.contains(var.name))
+    size = 4 * vector_types[var.name].second;
+  else if (var.name == "string")
+    size = 16;
+  else if (is_map(var))
+    size = 40;
+  else if (structs.contains(var.name)) {
+    size = 0;
+    for (auto &field : structs[var.name]->fields)
+      size += type_size(field.second);
+  }
+  return var.count > 0 ? size * var.count : size;
+}
+
+bool array_written(const std::vector<Statement> &body,
+                   const std::string &name);
+bool string_kept(const std::vector<Statement> &body, const std::string &name,
+                 bool &returned);
+
+// A local string whose value is only ever read, compared or joined into
+// other strings owns the buffer its concatenations are built in, so
+// s = s + x appends in place. The buffer is freed when the variable goes out
+// of scope, or handed to the caller when the function returns the variable.
+std::string generate_owned_string(const ASTVarDeclare &decl, bool returned) {
+  require_runtime("string");
+  std::string owner = "__inn_own_" + decl.name;
+  std::string res = "inn_str_owner " + owner +
+                    (returned ? "" : " __attribute__((cleanup("
+                                     "inn_str_owner_release)))") +
+                    " = {0};\n" + generate_type(decl.type, decl.name) + "=";
+  auto value = decl.value.has_value()
+                   ? std::get_if<ASTOperation>(&decl.value->value)
+                   : nullptr;
+  if (value != nullptr && value->op == Operator::Add &&
+      is_string(*value->left))
+    res += generate_concat(*value, owner);
+  else if (decl.value.has_value())
+    res += generate_typed(decl.value.value(), decl.type);
+  else
+    res += "{0}";
+  declare_var(decl.name, decl.type);
+  scopes.back().owners[decl.name] = owner;
+  return res + ";\n";
+}
+
+// Local arrays too large for the stack live on the heap until their scope
+// ends, zeroed like a static array would be.
+std::string generate_heap_array(const ASTVarDeclare &decl) {
+  require_runtime("heap");
+  std::string ptr = "__inn_heap_" + decl.name, target = "(*" + ptr + ")";
+  ASTType type = resolve_type(decl.type);
+  std::string res = generate_type(type, target) +
+                    " __attribute__((cleanup(inn_heap_release))) = "
+                    "inn_heap_alloc(sizeof(" +
+                    target + "));\n";
+  if (decl.value.has_value()) {
+    if (auto value = constant_init(decl)) {
+      std::string image = "__inn_init_" + decl.name;
+      res += "static const " + generate_type(type, image) + " = " +
+             c_value(value.value()) + ";\n";
+      res += "__builtin_memcpy(" + target + ", " + image + ", sizeof(" +
+             target + "));\n";
+    } else if (auto arr = std::get_if<ASTArray>(&decl.value->value)) {
+      ASTType elem{type.name, 0};
+      for (size_t i = 0; i < arr->values.size(); ++i)
+        res += target + "[" + std::to_string(i) +
+               "] = " + generate_typed(arr->values[i], elem) + ";\n";
+    } else {
+      res += generate_array_assign(target, type, decl.value.value());
+    }
+  }
+  declare_var(decl.name, decl.type, target);
+  return res;
+}
+
+std::string generate_one(const ASTVarDeclare &decl) {
+  if (decl.is_const)
+    return generate_const(decl);
+  if (is_map(decl.type) && decl.type.count == 0 && decl.value.has_value() &&
+      !std::holds_alternative<ASTFuncCall>(decl.value->value))
+    throw std::runtime_error("Maps can't be copied, start " + decl.name +
+                             " empty.");
+  // Tables a function only reads needn't be rebuilt on every call.
+  if (current_function != nullptr && is_array(decl.type) &&
+      decl.value.has_value() &&
+      !array_written(current_function->body, decl.name))
+    if (auto value = constant_init(decl))
+      return generate_static(decl, std::move(value.value()));
+  if (current_gen != nullptr)
+    return generate_gen_local(decl);
+  if (scopes.size() > 1 && decl.type.count > 0 &&
+      !(decl.type.soa && decl.value.has_value()) &&
+      type_size(decl.type) > codegen_options.stack_array_limit)
+    return generate_heap_array(decl);
+  bool returned = false;
+  if (current_function != nullptr && scopes.size() > 1 &&
+      resolve_type(decl.type).name == "string" && decl.type.count == 0 &&
+      !string_kept(current_function->body, decl.name, returned))
+    return generate_owned_string(decl, returned);
+  std::string res{};
+  res += generate_type(decl.type, decl.name);
+  auto fcall = decl.value.has_value()
+                   ? std::get_if<ASTFuncCall>(&decl.value->value)
+                   : nullptr;
+  if (fcall != nullptr && is_array(decl.type)) {
+    if (auto value = fold_call(*fcall)) {
+      try {
+        res += "=" + c_value(convert(value.value(), resolve_type(decl.type))) +
+               ";\n";
+      } catch (const EvalError &e) {
+        throw std::runtime_error("Cannot initialize " + decl.name + ": " +
+                                 e.what());
+      }
+      declare_var(decl.name, decl.type);
+      return res;
+    }
+  }
+  if (decl.value.has_value() && is_array(decl.type) &&
+      !std::holds_alternative<ASTArray>(decl.value->value)) {
+    if (scopes.size() == 1)
+      throw std::runtime_error("Array " + decl.name + " can only be "
+                               "initialized from other arrays inside a "
+                               "function.");
+    res += ";\n" +
+           generate_array_assign(decl.name, decl.type, decl.value.value());
+    declare_var(decl.name, decl.type);
+    return res;
+  }
+  if (decl.value.has_value()) {
+    res += "=" + generate_typed(decl.value.value(), decl.type);
+  } else if (type_modules.contains(resolve_type(decl.type).name) ||
+             is_map(decl.type)) {
+    res += "={0}";
+  }
+  res += ";\n";
+  declare_var(decl.name, decl.type);
+  return res;
+}
+
+// Counts one trip of the loop at `pos` in profiled builds.
+std::string profile_trip(Position pos) {
+  if (!codegen_options.profile)
+    return "";
+  profile_loops.push_back({"", pos});
+  return "inn_prof_trip(" + std::to_string(profile_loops.size() - 1) + ");\n";
+}
+
+// Debuggers, profilers and the C compiler's own messages then point at the
+// source line instead of the generated C.
+std::string line_directive(Position pos) {
+  if (!codegen_options.debug)
+    return "";
+  return "#line " + std::to_string(source_lines.locate(pos).first) + " " +
+         quote(codegen_options.source_name) + "\n";
+}
+
+// Errors without a position of their own point at the statement or
+// declaration being generated.
+template <typename F> std::string generate_at(Position pos, F generate) {
+  try {
+    return generate();
+  } catch (const SourceError &) {
+    throw;
+  } catch (const std::runtime_error &err) {
+    throw SourceError(pos, err.what());
+  }
+}
+
+std::string generate_block(const std::vector<Statement> &body) {
+  std::string res{};
+  scopes.emplace_back();
+  for (auto &s : body) {
+    res += line_directive(s.pos) +
+           generate_at(s.pos, [&] { return generate_one(s); });
+  }
+  scopes.pop_back();
+  return res;
+}
+
+std::string generate_one(const ASTIf &stmt) {
+  std::string res{};
+  res += "if (" + generate_one(stmt.branches[0].first) +
+         ") {\n";
+  res += generate_block(stmt.branches[0].second);
+  res += "}";
+  for (size_t i = 1; i < stmt.branches.size(); ++i) {
+    res += "else if (" +
+           generate_one(stmt.branches[i].first) + ") {\n";
+    res += generate_block(stmt.branches[i].second);
     res += "}";
   }
   if (stmt.otherwise.size() > 0) {
     res += "else {\n";
-    for (auto &s : stmt.otherwise) {
-      res += generate_one(s);
-    }
+    res += generate_block(stmt.otherwise);
     res += "}";
   }
   res += "\n";
@@ -183,44 +1989,1443 @@ std::string generate_one(const ASTIf &stmt) {
 std::string generate_one(const ASTWhile &stmt) {
   std::string res{};
   res += "while (" + generate_one(stmt.condition) + ") {\n";
-  for (auto &s : stmt.body) {
-    res += generate_one(s);
-  }
+  res += profile_trip(stmt.pos);
+  res += generate_block(stmt.body);
   res += "}\n";
   return res;
 }
 
-std::string generate_one(const ASTFuncDeclare &stmt) {
-  std::string res{};
-  res += stmt.ret.name;
+// main receives its arguments from C, so a []string parameter arrives as
+// char** and gets converted on entry.
+bool is_c_argv(const ASTFuncDeclare &stmt, size_t i) {
+  auto &type = stmt.args[i].second;
+  return stmt.name == "main" && i == 1 && type.name == "string" &&
+         type.count == -1;
+}
+
+std::string c_param_name(const ASTFuncDeclare &stmt, size_t i) {
+  if (is_c_argv(stmt, i))
+    return "__inn_" + stmt.args[i].first;
+  return stmt.args[i].first;
+}
+
+// Types C and C++ callers can pass to a --shared library as they are:
+// numbers, structs of them, and arrays and pointers of either.
+bool c_abi_type(const ASTType &type) {
+  ASTType var = resolve_type(type);
+  if (var.soa)
+    return false;
+  if (numeric_types.contains(var.name))
+    return true;
+  auto it = structs.find(var.name);
+  if (it == structs.end())
+    return false;
+  for (auto &field : it->second->fields)
+    if (!c_abi_type(field.second))
+      return false;
+  return true;
+}
+
+// Funcs a --shared library exports. Others stay hidden in it.
+bool exported(const ASTFuncDeclare &fdecl) {
+  if (!codegen_options.shared || fdecl.name == "main" || is_generic(fdecl) ||
+      fdecl.is_gen || compile_time_only(fdecl))
+    return false;
+  for (auto &arg : fdecl.args)
+    if (!c_abi_type(arg.second))
+      return false;
+  return (fdecl.ret.name == "void" && fdecl.ret.count == 0) ||
+         c_abi_type(fdecl.ret);
+}
+
+// Builtins computed from their argument values alone, those reading only
+// the arrays they're given, and those reading other memory, like strings.
+std::unordered_set<std::string> const_builtins{
+    "len",         "vec4f_splat", "vec4f_sum",   "vec8f_splat", "vec8f_sum",
+    "vec4i_splat", "vec4i_sum",   "vec8i_splat", "vec8i_sum"};
+std::unordered_set<std::string> array_builtins{
+    "sum",        "min",        "max",        "dot",       "count_if",
+    "vec4f_load", "vec8f_load", "vec4i_load", "vec8i_load"};
+std::unordered_set<std::string> pure_builtins{
+    "slice",   "parse_int", "parse_float", "map_has",
+    "map_len", "map_keys",  "map_values"};
+// Builtins changing the map they're given.
+std::unordered_set<std::string> map_writers{"map_del", "map_reserve",
+                                            "map_clear", "map_free"};
+
+// Whether `name` is bare argument i of a call that may write through it or
+// keep it, as a slice does.
+bool lends_array(const ASTFuncCall &fcall, size_t i, const std::string &name) {
+  if (symbol_name(fcall.args[i]) != name)
+    return false;
+  std::string callee = callee_name(fcall);
+  if (!functions.contains(callee))
+    return !const_builtins.contains(callee) &&
+           !array_builtins.contains(callee) && callee != "print" &&
+           callee != "println";
+  auto it = effects.find(callee);
+  return it == effects.end() || i >= it->second.read_only.size() ||
+         !it->second.read_only[i];
+}
+
+bool array_written(const Expr &ex, const std::string &name) {
+  if (auto arr = std::get_if<ASTArray>(&ex.value)) {
+    for (auto &value : arr->values)
+      if (array_written(value, name))
+        return true;
+  } else if (auto op = std::get_if<ASTOperation>(&ex.value)) {
+    if ((op->op == Operator::Assign &&
+         (root_name(*op->left) == name || symbol_name(*op->right) == name)) ||
+        (op->op == Operator::Ref && root_name(*op->right) == name))
+      return true;
+    return (op->left != nullptr && array_written(*op->left, name)) ||
+           (op->right != nullptr && array_written(*op->right, name));
+  } else if (auto fcall = std::get_if<ASTFuncCall>(&ex.value)) {
+    for (size_t i = 0; i < fcall->args.size(); ++i)
+      if (lends_array(*fcall, i, name) || array_written(fcall->args[i], name))
+        return true;
+    return array_written(*fcall->callee, name);
+  }
+  return false;
+}
+
+// Whether a function body may change the array `name` after declaring it,
+// or hand it somewhere that could. Names are matched without scopes, so
+// shadowing only makes this more careful.
+bool array_written(const std::vector<Statement> &body,
+                   const std::string &name) {
+  for (auto &stmt : body) {
+    if (auto decl = std::get_if<ASTVarDeclare>(&stmt.value)) {
+      if (decl->value.has_value() &&
+          (symbol_name(decl->value.value()) == name ||
+           array_written(decl->value.value(), name)))
+        return true;
+    } else if (auto ex = std::get_if<Expr>(&stmt.value)) {
+      if (array_written(*ex, name))
+        return true;
+    } else if (auto whl = std::get_if<ASTWhile>(&stmt.value)) {
+      if (array_written(whl->condition, name) ||
+          array_written(whl->body, name))
+        return true;
+    } else if (auto ifs = std::get_if<ASTIf>(&stmt.value)) {
+      for (auto &branch : ifs->branches)
+        if (array_written(branch.first, name) ||
+            array_written(branch.second, name))
+          return true;
+      if (array_written(ifs->otherwise, name))
+        return true;
+    } else if (auto ret = std::get_if<ASTReturn>(&stmt.value)) {
+      if (ret->what.has_value() && (symbol_name(ret->what.value()) == name ||
+                                    array_written(ret->what.value(), name)))
+        return true;
+    } else if (auto yld = std::get_if<ASTYield>(&stmt.value)) {
+      if (symbol_name(yld->what) == name || array_written(yld->what, name))
+        return true;
+    } else if (auto loop = std::get_if<ASTFor>(&stmt.value)) {
+      if (array_written(loop->source, name) || array_written(loop->body, name))
+        return true;
+    }
+  }
+  return false;
+}
+
+// Builtins which only read the bytes of the strings they're given.
+std::unordered_set<std::string> string_readers{
+    "len",    "cstr",           "concat",    "print",      "println",
+    "printf", "builder_append", "parse_int", "parse_float"};
+
+// Whether `ex` may keep the string `name` past its statement, by storing it,
+// passing it on, slicing it or assigning it in the middle of an expression.
+// Reading its bytes, comparing it and joining it into a new string don't.
+bool string_kept(const Expr &ex, const std::string &name) {
+  if (symbol_name(ex) == name)
+    return true;
+  if (auto arr = std::get_if<ASTArray>(&ex.value))
+    return std::any_of(arr->values.begin(), arr->values.end(),
+                       [&](auto &value) { return string_kept(value, name); });
+  if (auto op = std::get_if<ASTOperation>(&ex.value)) {
+    bool reads = op->op != Operator::Assign && op->op != Operator::Ref &&
+                 op->op != Operator::Spawn && op->op != Operator::Member;
+    auto kept = [&](const std::unique_ptr<Expr> &side, bool read) {
+      return side != nullptr && !(read && symbol_name(*side) == name) &&
+             string_kept(*side, name);
+    };
+    return kept(op->left, reads) ||
+           kept(op->right, reads && op->op != Operator::Index);
+  }
+  if (auto fcall = std::get_if<ASTFuncCall>(&ex.value)) {
+    std::string callee = callee_name(*fcall);
+    bool reads = string_readers.contains(callee) && !functions.contains(callee);
+    for (auto &arg : fcall->args)
+      if (!(reads && symbol_name(arg) == name) && string_kept(arg, name))
+        return true;
+    return string_kept(*fcall->callee, name);
+  }
+  return false;
+}
+
+// Whether a function body may keep the string `name` anywhere outliving the
+// statement using it. Returning it as is only sets `returned`. Names are
+// matched without scopes like for array_written.
+bool string_kept(const std::vector<Statement> &body, const std::string &name,
+                 bool &returned) {
+  for (auto &stmt : body) {
+    if (auto decl = std::get_if<ASTVarDeclare>(&stmt.value)) {
+      if (decl->value.has_value() && string_kept(decl->value.value(), name))
+        return true;
+    } else if (auto ex = std::get_if<Expr>(&stmt.value)) {
+      // Assigned as a whole statement, nothing else sees the old value.
+      auto op = std::get_if<ASTOperation>(&ex->value);
+      if (op != nullptr && op->op == Operator::Assign &&
+          symbol_name(*op->left) == name) {
+        if (string_kept(*op->right, name))
+          return true;
+      } else if (string_kept(*ex, name)) {
+        return true;
+      }
+    } else if (auto whl = std::get_if<ASTWhile>(&stmt.value)) {
+      if (string_kept(whl->condition, name) ||
+          string_kept(whl->body, name, returned))
+        return true;
+    } else if (auto ifs = std::get_if<ASTIf>(&stmt.value)) {
+      for (auto &branch : ifs->branches)
+        if (string_kept(branch.first, name) ||
+            string_kept(branch.second, name, returned))
+          return true;
+      if (string_kept(ifs->otherwise, name, returned))
+        return true;
+    } else if (auto ret = std::get_if<ASTReturn>(&stmt.value)) {
+      if (ret->what.has_value() && symbol_name(ret->what.value()) == name)
+        returned = true;
+      else if (ret->what.has_value() && string_kept(ret->what.value(), name))
+        return true;
+    } else if (auto yld = std::get_if<ASTYield>(&stmt.value)) {
+      if (string_kept(yld->what, name))
+        return true;
+    } else if (auto loop = std::get_if<ASTFor>(&stmt.value)) {
+      if (string_kept(loop->source, name) ||
+          string_kept(loop->body, name, returned))
+        return true;
+    }
+  }
+  return false;
+}
+
+bool by_pointer(const ASTType &type) {
+  return type.count != 0 || by_address(type);
+}
+
+// Whether `stmt` is name = name + 1, or name - 1 when `step` is Sub.
+bool steps_by_one(const Statement &stmt, const std::string &name,
+                  Operator step) {
+  auto ex = std::get_if<Expr>(&stmt.value);
+  auto op = ex != nullptr ? std::get_if<ASTOperation>(&ex->value) : nullptr;
+  if (op == nullptr || op->op != Operator::Assign ||
+      symbol_name(*op->left) != name)
+    return false;
+  auto value = std::get_if<ASTOperation>(&op->right->value);
+  if (value == nullptr || value->op != step)
+    return false;
+  auto one = [](const Expr &e) {
+    auto sing = std::get_if<ASTSingular>(&e.value);
+    auto lit = sing != nullptr ? std::get_if<ASTInt>(sing) : nullptr;
+    return lit != nullptr && lit->value == 1;
+  };
+  return (symbol_name(*value->left) == name && one(*value->right)) ||
+         (step == Operator::Add && one(*value->left) &&
+          symbol_name(*value->right) == name);
+}
+
+bool among(const std::string &name, const std::vector<std::string> &names) {
+  return std::find(names.begin(), names.end(), name) != names.end();
+}
+
+// How often `ex` assigns or references any of `names`.
+size_t assignments(const Expr &ex, const std::vector<std::string> &names) {
+  size_t found = 0;
+  if (auto op = std::get_if<ASTOperation>(&ex.value)) {
+    if ((op->op == Operator::Assign && among(root_name(*op->left), names)) ||
+        (op->op == Operator::Ref && among(root_name(*op->right), names)))
+      ++found;
+    if (op->left != nullptr)
+      found += assignments(*op->left, names);
+    if (op->right != nullptr)
+      found += assignments(*op->right, names);
+  } else if (auto fcall = std::get_if<ASTFuncCall>(&ex.value)) {
+    for (auto &arg : fcall->args)
+      found += assignments(arg, names);
+  } else if (auto arr = std::get_if<ASTArray>(&ex.value)) {
+    for (auto &value : arr->values)
+      found += assignments(value, names);
+  }
+  return found;
+}
+
+// Declaring one of `names` counts twice, since the loop may then step the
+// inner variable instead.
+size_t assignments(const std::vector<Statement> &body,
+                   const std::vector<std::string> &names) {
+  size_t found = 0;
+  for (auto &stmt : body) {
+    if (auto decl = std::get_if<ASTVarDeclare>(&stmt.value)) {
+      found += among(decl->name, names) ? 2 : 0;
+      if (decl->value.has_value())
+        found += assignments(decl->value.value(), names);
+    } else if (auto ex = std::get_if<Expr>(&stmt.value)) {
+      found += assignments(*ex, names);
+    } else if (auto whl = std::get_if<ASTWhile>(&stmt.value)) {
+      found += assignments(whl->condition, names) +
+               assignments(whl->body, names);
+    } else if (auto ifs = std::get_if<ASTIf>(&stmt.value)) {
+      for (auto &branch : ifs->branches)
+        found += assignments(branch.first, names) +
+                 assignments(branch.second, names);
+      found += assignments(ifs->otherwise, names);
+    } else if (auto ret = std::get_if<ASTReturn>(&stmt.value)) {
+      if (ret->what.has_value())
+        found += assignments(ret->what.value(), names);
+    } else if (auto yld = std::get_if<ASTYield>(&stmt.value)) {
+      found += assignments(yld->what, names);
+    } else if (auto loop = std::get_if<ASTFor>(&stmt.value)) {
+      found += (among(loop->name, names) ? 2 : 0) +
+               assignments(loop->source, names) +
+               assignments(loop->body, names);
+    }
+  }
+  return found;
+}
+
+// Walks one function body, with the parameters in scopes[base] and the
+// globals in the scope before it.
+struct EffectScan {
+  const ASTFuncDeclare *fdecl; // Null for top level statements
+  size_t base;
+  const std::unordered_set<std::string> &mutable_globals;
+  Effects fx{};
+  // Pointer parameters whose value goes somewhere we can't follow, those
+  // handed to a function that may write through them, and those reassigned.
+  std::vector<bool> escaped{}, lent{}, reassigned{};
+
+  // Strings never change, so `changes` is false for reading them.
+  void lower(Purity purity, const std::string &reason, bool changes = true) {
+    if (purity == Purity::Pure && changes && fx.changing.empty())
+      fx.changing = reason;
+    if (purity > fx.purity) {
+      fx.purity = purity;
+      fx.reason = reason;
+    }
+  }
+
+  size_t scope_of(const std::string &name) {
+    for (size_t i = scopes.size(); i > 0; --i)
+      if (scopes[i - 1].vars.contains(name))
+        return i - 1;
+    return 0;
+  }
+
+  int param(const std::string &name) {
+    if (fdecl == nullptr || name.empty() || scope_of(name) != base)
+      return -1;
+    for (size_t i = 0; i < fdecl->args.size(); ++i)
+      if (fdecl->args[i].first == name)
+        return i;
+    return -1;
+  }
+
+  bool is_global(const std::string &name) {
+    return scope_of(name) == base - 1 && mutable_globals.contains(name);
+  }
+
+  // Bound to numbers too in the instances that get attributes.
+  bool is_type_param(const std::string &name) {
+    return fdecl != nullptr &&
+           std::find(fdecl->type_params.begin(), fdecl->type_params.end(),
+                     name) != fdecl->type_params.end();
+  }
+
+  bool is_local(const std::string &name) {
+    return scope_of(name) >= base && param(name) < 0;
+  }
+
+  void read(const Expr &ex) {
+    if (auto sing = std::get_if<ASTSingular>(&ex.value)) {
+      if (auto sym = std::get_if<ASTSymbol>(sing))
+        read_var(sym->value);
+    } else if (auto arr = std::get_if<ASTArray>(&ex.value)) {
+      for (auto &value : arr->values)
+        read(value);
+    } else if (auto op = std::get_if<ASTOperation>(&ex.value)) {
+      operation(*op);
+    } else if (auto fcall = std::get_if<ASTFuncCall>(&ex.value)) {
+      call(*fcall);
+    }
+  }
+
+  // Naming an array reads its elements, whether it's indexed or used whole.
+  void read_var(const std::string &name) {
+    auto type = lookup_var(name);
+    if (!type.has_value()) {
+      // A function used as a value may be called from anywhere.
+      auto it = effects.find(name);
+      if (it != effects.end())
+        for (size_t i = 0; i < it->second.restricted.size(); ++i)
+          unrestrict(name, i);
+      return;
+    }
+    if (param(name) >= 0) {
+      if (by_pointer(type.value()))
+        lower(Purity::Pure, "reads through " + name);
+    } else if (is_global(name)) {
+      lower(Purity::Pure, "reads global " + name);
+      fx.global_memory |= by_pointer(type.value());
+    } else if (type->count == -1) {
+      lower(Purity::Pure, "reads through " + name);
+    }
+  }
+
+  void operation(const ASTOperation &op) {
+    if (op.op == Operator::Assign && map_entry(*op.left))
+      lower(Purity::Impure, "allocates map memory");
+    if (op.op == Operator::Assign) {
+      auto target = infer_type(*op.left);
+      if (target.has_value() && target->count == -1)
+        escape(*op.right);
+      else
+        read(*op.right);
+      write(*op.left, true);
+      return;
+    }
+    if (op.op == Operator::Ref)
+      return escape(*op.right);
+    if (op.op == Operator::Spawn)
+      lower(Purity::Impure, "spawns tasks");
+    if (op.op == Operator::Member)
+      return read(*op.left);
+    if (op.op == Operator::Add && is_string(*op.left))
+      lower(Purity::Impure, "allocates strings");
+    if ((op.op == Operator::Equal || op.op == Operator::Index) &&
+        op.left != nullptr && is_string(*op.left))
+      lower(Purity::Pure, "reads string bytes", false);
+    // Maps are held by address, even in structs passed by value.
+    if (op.op == Operator::Index && op.right != nullptr &&
+        is_map(infer_type(*op.left)))
+      lower(Purity::Pure, "reads map entries");
+    if (op.left != nullptr)
+      read(*op.left);
+    if (op.right != nullptr)
+      read(*op.right);
+  }
+
+  // The address of `ex` is kept or passed somewhere we don't follow.
+  void escape(const Expr &ex) {
+    std::string root = root_name(ex);
+    if (int p = param(root); p >= 0)
+      escaped[p] = true;
+    else if (is_global(root))
+      fx.global_memory = true;
+    read(ex);
+  }
+
+  // Assigning to `target`, all of it if `whole`.
+  void write(const Expr &target, bool whole) {
+    auto op = std::get_if<ASTOperation>(&target.value);
+    if (op != nullptr &&
+        (op->op == Operator::Index || op->op == Operator::Member)) {
+      if (op->op == Operator::Index && op->right != nullptr)
+        read(*op->right);
+      auto base_type = infer_type(*op->left);
+      if (base_type.has_value() && base_type->count == -1 &&
+          symbol_name(*op->left).empty())
+        return lower(Purity::Impure, "writes through a pointer");
+      return write(*op->left, false);
+    }
+    std::string name = symbol_name(target);
+    auto type = lookup_var(name);
+    if (!type.has_value())
+      return lower(Purity::Impure, "writes through a pointer");
+    if (int p = param(name); p >= 0) {
+      if (whole && type->count == -1)
+        reassigned[p] = true;
+      else if (by_pointer(type.value()))
+        fx.written[p] = true;
+    } else if (is_global(name)) {
+      lower(Purity::Impure, "writes global " + name);
+    } else if (!whole && type->count == -1) {
+      lower(Purity::Impure, "writes through " + name);
+    }
+  }
+
+  void unrestrict(const std::string &callee, size_t i) {
+    auto &flags = effects[callee].restricted;
+    if (i < flags.size() && flags[i]) {
+      flags[i] = false;
+      effects_changed = true;
+    }
+  }
+
+  // Whether `root`, passed as parameter i of `callee`, can't overlap any
+  // memory the callee reaches another way.
+  bool separate(const std::string &root, const ASTFuncDeclare &callee,
+                size_t i) {
+    if (int p = param(root); p >= 0)
+      return effects[fdecl->name].restricted[p] &&
+             (fdecl != &callee || size_t(p) == i);
+    auto type = lookup_var(root);
+    return type.has_value() && type->count > 0 && !type->soa &&
+           (is_local(root) || scope_of(root) == base - 1);
+  }
+
+  void call_function(const ASTFuncDeclare &callee, const ASTFuncCall &fcall) {
+    if (compile_time_only(callee)) {
+      for (auto &arg : fcall.args)
+        read(arg);
+      return;
+    }
+    auto &cx = effects[callee.name];
+    // Unproven until the callee is, so recursion never is.
+    fx.terminates &= fdecl != &callee && cx.terminates;
+    // Recursion adds nothing the function doesn't already do.
+    if (fdecl != &callee) {
+      lower(cx.purity, "calls " + callee.name, !cx.changing.empty());
+      fx.global_memory |= cx.global_memory;
+    }
+    if (is_generic(callee)) {
+      std::string error{};
+      auto bindings = bind_type_params(callee, fcall, error);
+      if (bindings.has_value())
+        for (auto &binding : bindings.value())
+          if (!numeric_types.contains(binding.second) &&
+              !is_type_param(binding.second))
+            lower(Purity::Impure, "calls " + callee.name + " on " +
+                                      binding.second);
+    }
+    std::vector<std::string> roots{};
+    for (size_t i = 0; i < fcall.args.size(); ++i) {
+      auto &arg = fcall.args[i];
+      if (i >= callee.args.size() || !by_pointer(callee.args[i].second)) {
+        read(arg);
+        continue;
+      }
+      std::string root = symbol_name(arg);
+      auto op = std::get_if<ASTOperation>(&arg.value);
+      if (root.empty()) {
+        read(arg);
+        if (cx.written[i] && op != nullptr && op->op == Operator::Ref)
+          write(*op->right, false);
+        else if (cx.written[i])
+          lower(Purity::Impure, "writes through a pointer");
+      } else if (int p = param(root); p >= 0) {
+        fx.written[p] = fx.written[p] || cx.written[i];
+        lent[p] = lent[p] || !cx.read_only[i];
+      } else if (is_global(root)) {
+        fx.global_memory = true;
+        lower(Purity::Pure, "reads global " + root);
+        if (cx.written[i])
+          lower(Purity::Impure, "writes global " + root);
+      } else if (cx.written[i] && lookup_var(root).has_value() &&
+                 lookup_var(root)->count == -1) {
+        lower(Purity::Impure, "writes through " + root);
+      }
+      // restrict parameters only hold if nothing else reaches their memory.
+      bool overlaps = root.empty() ||
+                      std::find(roots.begin(), roots.end(), root) !=
+                          roots.end();
+      for (size_t j = 0; j < roots.size(); ++j)
+        if (roots[j] == root)
+          unrestrict(callee.name, j);
+      if (overlaps || !separate(root, callee, i))
+        unrestrict(callee.name, i);
+      roots.push_back(root);
+    }
+  }
+
+  void call(const ASTFuncCall &fcall) {
+    std::string name = callee_name(fcall);
+    auto it = functions.find(name);
+    if (it != functions.end() && !lookup_var(name))
+      return call_function(*it->second, fcall);
+    bool stores = name == "prefix_sum" || map_writers.contains(name) ||
+                  (name.ends_with("_store") && builtins.contains(name));
+    if (name == "map_reserve")
+      lower(Purity::Impure, "allocates map memory");
+    bool known = stores || is_conversion(fcall) ||
+                 const_builtins.contains(name) ||
+                 array_builtins.contains(name) || pure_builtins.contains(name);
+    if (!known)
+      lower(Purity::Impure, "calls " + name);
+    else if (pure_builtins.contains(name))
+      lower(Purity::Pure, "calls " + name, !name.starts_with("parse_") &&
+                                               name != "slice");
+    for (size_t i = 0; i < fcall.args.size(); ++i) {
+      auto type = infer_type(fcall.args[i]);
+      if (stores && i == 0)
+        write(fcall.args[i], false);
+      else if (!known && type.has_value() && by_pointer(type.value()))
+        escape(fcall.args[i]); // C may write through whatever it's given
+      else
+        read(fcall.args[i]);
+    }
+  }
+
+  void statement(const Statement &stmt) {
+    if (auto decl = std::get_if<ASTVarDeclare>(&stmt.value)) {
+      if (decl->value.has_value() && !decl->is_const) {
+        if (decl->type.count == -1)
+          escape(decl->value.value());
+        else
+          read(decl->value.value());
+      }
+      declare_var(decl->name, decl->type);
+    } else if (auto ex = std::get_if<Expr>(&stmt.value)) {
+      read(*ex);
+    } else if (auto whl = std::get_if<ASTWhile>(&stmt.value)) {
+      fx.terminates &= counted(*whl);
+      read(whl->condition);
+      block(whl->body);
+    } else if (auto ifs = std::get_if<ASTIf>(&stmt.value)) {
+      for (auto &branch : ifs->branches) {
+        read(branch.first);
+        block(branch.second);
+      }
+      block(ifs->otherwise);
+    } else if (auto ret = std::get_if<ASTReturn>(&stmt.value)) {
+      if (ret->what.has_value() && fdecl->ret.count != 0)
+        escape(ret->what.value());
+      else if (ret->what.has_value())
+        read(ret->what.value());
+    } else if (auto yld = std::get_if<ASTYield>(&stmt.value)) {
+      read(yld->what);
+    } else if (auto loop = std::get_if<ASTFor>(&stmt.value)) {
+      // The loop runs the whole generator, much like calling it.
+      read(loop->source);
+      scopes.emplace_back();
+      auto elem = infer_type(loop->source);
+      declare_var(loop->name, elem.value_or(ASTType{"int", 0}));
+      block(loop->body);
+      scopes.pop_back();
+    }
+  }
+
+  void block(const std::vector<Statement> &body) {
+    scopes.emplace_back();
+    for (auto &stmt : body)
+      statement(stmt);
+    scopes.pop_back();
+  }
+
+  // Whether `ex` has type `type` and reads only local variables, which are
+  // added to `names`. Arithmetic on types narrower than int is promoted, so
+  // they're limited to a variable or literal.
+  bool loop_bound(const Expr &ex, const std::string &type,
+                  std::vector<std::string> &names) {
+    if (auto sing = std::get_if<ASTSingular>(&ex.value)) {
+      if (auto lit = std::get_if<ASTInt>(sing))
+        return lit->type == type;
+      std::string name = symbol_name(ex);
+      auto var = lookup_var(name);
+      if (name.empty() || !var.has_value() || var->count != 0 ||
+          var->name != type || scope_of(name) < base)
+        return false;
+      names.push_back(name);
+      return true;
+    }
+    auto op = std::get_if<ASTOperation>(&ex.value);
+    return op != nullptr &&
+           (op->op == Operator::Add || op->op == Operator::Sub ||
+            op->op == Operator::Mul || op->op == Operator::Neg) &&
+           numeric_types[type].bits >= 32 &&
+           (op->left == nullptr || loop_bound(*op->left, type, names)) &&
+           loop_bound(*op->right, type, names);
+  }
+
+  // Whether a while loop is sure to finish: it tests i < n or i > n on a
+  // local integer which a statement of its own in the body steps by one
+  // towards n, and nothing in the body assigns i otherwise or anything n
+  // reads. n has i's type, so the step can't overflow before the test fails.
+  bool counted(const ASTWhile &whl) {
+    auto cond = std::get_if<ASTOperation>(&whl.condition.value);
+    if (cond == nullptr ||
+        (cond->op != Operator::Less && cond->op != Operator::Greater))
+      return false;
+    for (int side = 0; side < 2; ++side) {
+      auto &counter = side == 0 ? *cond->left : *cond->right;
+      auto &bound = side == 0 ? *cond->right : *cond->left;
+      std::string name = symbol_name(counter);
+      auto type = lookup_var(name);
+      if (name.empty() || !type.has_value() || type->count != 0 ||
+          !numeric_types.contains(type->name) ||
+          numeric_types[type->name].is_float || scope_of(name) < base)
+        continue;
+      std::vector<std::string> names{name};
+      if (!loop_bound(bound, type->name, names))
+        continue;
+      // i < n counts up, n < i counts down.
+      Operator step = (cond->op == Operator::Less) == (side == 0)
+                          ? Operator::Add
+                          : Operator::Sub;
+      // The step is then the only assignment.
+      if (std::any_of(whl.body.begin(), whl.body.end(),
+                      [&](auto &stmt) {
+                        return steps_by_one(stmt, name, step);
+                      }) &&
+          assignments(whl.body, names) == 1)
+        return true;
+    }
+    return false;
+  }
+};
+
+// Effects of `fdecl` given what's known of the functions it calls.
+Effects scan_effects(const ASTFuncDeclare &fdecl,
+                     const std::unordered_set<std::string> &mutable_globals) {
+  size_t n = fdecl.args.size();
+  EffectScan scan{&fdecl, scopes.size(), mutable_globals};
+  scan.fx.terminates = true;
+  scan.fx.written.assign(n, false);
+  scan.escaped = scan.lent = scan.reassigned = scan.fx.written;
+  scopes.emplace_back();
+  for (auto &arg : fdecl.args)
+    declare_var(arg.first, arg.second);
+  try {
+    scan.block(fdecl.body);
+  } catch (const std::runtime_error &) {
+    // Reported when the function is generated.
+    scan.fx.purity = Purity::Impure;
+    scan.fx.reason = "can't be analyzed";
+    scan.fx.terminates = false;
+    scan.escaped.assign(n, true);
+  }
+  scopes.resize(scan.base);
+  auto &fx = scan.fx;
+  size_t pointers = 0;
+  for (auto &arg : fdecl.args)
+    pointers += arg.second.count != 0 && !arg.second.soa;
+  fx.read_only.assign(n, false);
+  fx.restricted = effects[fdecl.name].restricted;
+  for (size_t i = 0; i < n; ++i) {
+    auto &type = fdecl.args[i].second;
+    bool plain = type.count != 0 && !type.soa && !is_c_argv(fdecl, i);
+    fx.read_only[i] =
+        plain && !fx.written[i] && !scan.escaped[i] && !scan.lent[i];
+    fx.restricted[i] = fx.restricted[i] && plain && !scan.escaped[i] &&
+                       !scan.reassigned[i] && !fx.global_memory &&
+                       pointers > 1 && fdecl.name != "main" && !fdecl.is_gen &&
+                       !exported(fdecl); // Callers outside may alias
+  }
+  return fx;
+}
+
+bool same_effects(const Effects &a, const Effects &b) {
+  return a.purity == b.purity && a.written == b.written &&
+         a.read_only == b.read_only && a.restricted == b.restricted &&
+         a.global_memory == b.global_memory && a.changing == b.changing &&
+         a.terminates == b.terminates;
+}
+
+// Starts with every function const and every pointer read-only and
+// restrict, and weakens them until calls agree with their callees.
+void analyze_effects(const std::vector<Paragraph> &roots) {
+  std::unordered_set<std::string> mutable_globals{};
+  scopes.emplace_back();
+  for (auto &para : roots)
+    if (auto stmt = std::get_if<Statement>(&para))
+      if (auto decl = std::get_if<ASTVarDeclare>(&stmt->value)) {
+        declare_var(decl->name, decl->type);
+        if (!decl->is_const)
+          mutable_globals.insert(decl->name);
+      }
+  for (auto &[name, fdecl] : functions) {
+    auto &fx = effects[name];
+    fx.written.assign(fdecl->args.size(), false);
+    fx.read_only = fx.restricted =
+        std::vector<bool>(fdecl->args.size(), true);
+  }
+  do {
+    effects_changed = false;
+    for (auto &para : roots) {
+      if (auto fdecl = std::get_if<ASTFuncDeclare>(&para)) {
+        Effects fx = scan_effects(*fdecl, mutable_globals);
+        if (!same_effects(fx, effects[fdecl->name]))
+          effects_changed = true;
+        effects[fdecl->name] = fx;
+      } else if (auto stmt = std::get_if<Statement>(&para)) {
+        // Only for the calls, which can rule out restrict parameters.
+        EffectScan scan{nullptr, scopes.size(), mutable_globals};
+        scopes.emplace_back();
+        try {
+          scan.statement(*stmt);
+        } catch (const std::runtime_error &) {
+        }
+        scopes.resize(scan.base);
+      }
+    }
+  } while (effects_changed);
+  scopes.pop_back();
+}
+
+// Purity of calls to `fdecl`, where writing through a parameter counts as
+// a side effect.
+Purity call_purity(const ASTFuncDeclare &fdecl, std::string &reason) {
+  auto &fx = effects[fdecl.name];
+  for (size_t i = 0; i < fx.written.size(); ++i)
+    if (fx.written[i]) {
+      reason = "writes through " + fdecl.args[i].first;
+      return Purity::Impure;
+    }
+  reason = fx.reason;
+  return fx.purity;
+}
+
+void report_effects(const std::vector<Paragraph> &roots) {
+  for (auto &para : roots) {
+    auto fdecl = std::get_if<ASTFuncDeclare>(&para);
+    if (fdecl == nullptr || compile_time_only(*fdecl))
+      continue;
+    std::string reason{};
+    Purity purity = call_purity(*fdecl, reason);
+    std::cerr << source_location(fdecl->pos) << ": " << fdecl->name
+              << (purity == Purity::Const  ? " is const"
+                  : purity == Purity::Pure ? " is pure"
+                                           : " has side effects");
+    if (!reason.empty())
+      std::cerr << ", " << reason;
+    auto &fx = effects[fdecl->name];
+    if (purity != Purity::Impure && !fx.terminates)
+      std::cerr << "; may not return";
+    for (size_t i = 0; i < fdecl->args.size(); ++i) {
+      if (!fx.read_only[i] && !fx.restricted[i])
+        continue;
+      std::cerr << "; " << fdecl->args[i].first << " is "
+                << (fx.read_only[i] ? "read-only" : "")
+                << (fx.read_only[i] && fx.restricted[i] ? " and " : "")
+                << (fx.restricted[i] ? "restrict" : "");
+    }
+    std::cerr << std::endl;
+  }
+}
+
+// __attribute__((const)) or pure for functions the C compiler may call
+// fewer times than written. Profiled builds count every call. A call whose
+// result is unused may be dropped, so functions which might not return, the
+// "looping const" ones, get neither.
+std::string purity_attribute(const ASTFuncDeclare &stmt) {
+  if (codegen_options.profile || stmt.name == "main" ||
+      stmt.ret.name == "void" || stmt.ret.count != 0 ||
+      !effects.contains(stmt.name) || !effects[stmt.name].terminates)
+    return "";
+  // Instances over other types may do more, like concatenating strings.
+  for (auto &binding : type_bindings)
+    if (!numeric_types.contains(binding.second))
+      return "";
+  std::string reason{};
+  Purity purity = call_purity(stmt, reason);
+  if (purity == Purity::Const)
+    return "__attribute__((const)) ";
+  if (purity == Purity::Pure)
+    return "__attribute__((pure)) ";
+  return "";
+}
+
+std::string generate_param(const ASTFuncDeclare &stmt, size_t i) {
+  auto &[name, type] = stmt.args[i];
+  if (is_c_argv(stmt, i))
+    return "char **" + c_param_name(stmt, i);
+  if (type.soa)
+    return soa_type_name(resolve_type(type)) + " *" + name;
+  if (by_address(type))
+    return generate_type(ASTType{type.name, -1}, name);
+  auto it = effects.find(stmt.name);
+  if (it == effects.end() || type.count == 0)
+    return generate_type(type, name);
+  std::string res = it->second.read_only[i] ? "const " : "";
+  if (!it->second.restricted[i])
+    return res + generate_type(type, name);
+  if (type.count == -1)
+    return res + generate_type(type, "restrict " + name);
+  return res + generate_type(ASTType{type.name, 0}, name) + "[restrict " +
+         std::to_string(type.count) + "]";
+}
+
+std::string generate_signature(const ASTFuncDeclare &stmt,
+                               const std::string &name) {
+  std::string res = purity_attribute(stmt);
+  res += generate_type(ASTType{stmt.ret.name, 0}, "");
   if (stmt.ret.count != 0)
     res += "*";
-  res += " " + stmt.name + "(";
+  res += " " + name + "(";
   for (size_t i = 0; i < stmt.args.size(); ++i) {
-    res += generate_type(stmt.args[i].second, stmt.args[i].first);
+    res += generate_param(stmt, i);
     if (i != stmt.args.size() - 1)
       res += ",";
   }
-  res += ") {\n";
-  for (auto &s : stmt.body) {
-    res += generate_one(s);
+  res += ")";
+  return res;
+}
+
+// Set once the current function jumps back to its start for a tail call.
+bool tail_loop = false;
+bool uses_musttail = false;
+
+bool frame_escapes(const Expr &ex);
+
+bool frame_escapes(const std::vector<Statement> &body);
+
+bool frame_escapes(const Statement &stmt) {
+  if (auto decl = std::get_if<ASTVarDeclare>(&stmt.value))
+    return decl->type.count > 0 || by_address(decl->type) ||
+           (decl->value.has_value() && frame_escapes(decl->value.value()));
+  if (auto ex = std::get_if<Expr>(&stmt.value))
+    return frame_escapes(*ex);
+  if (auto whl = std::get_if<ASTWhile>(&stmt.value))
+    return frame_escapes(whl->condition) || frame_escapes(whl->body);
+  if (auto ifs = std::get_if<ASTIf>(&stmt.value)) {
+    for (auto &branch : ifs->branches)
+      if (frame_escapes(branch.first) || frame_escapes(branch.second))
+        return true;
+    return frame_escapes(ifs->otherwise);
+  }
+  if (auto ret = std::get_if<ASTReturn>(&stmt.value))
+    return ret->what.has_value() && frame_escapes(ret->what.value());
+  if (auto yld = std::get_if<ASTYield>(&stmt.value))
+    return frame_escapes(yld->what);
+  if (auto loop = std::get_if<ASTFor>(&stmt.value))
+    return frame_escapes(loop->source) || frame_escapes(loop->body);
+  return false;
+}
+
+bool frame_escapes(const std::vector<Statement> &body) {
+  for (auto &stmt : body)
+    if (frame_escapes(stmt))
+      return true;
+  return false;
+}
+
+// Whether pointers into the function's locals can exist, through &, a
+// local array decaying to a pointer or a map passed by address. Such a
+// frame can't be reused by a tail call.
+bool frame_escapes(const Expr &ex) {
+  if (auto op = std::get_if<ASTOperation>(&ex.value))
+    return op->op == Operator::Ref ||
+           (op->left != nullptr && frame_escapes(*op->left)) ||
+           (op->right != nullptr && frame_escapes(*op->right));
+  if (auto fcall = std::get_if<ASTFuncCall>(&ex.value)) {
+    for (auto &arg : fcall->args)
+      if (frame_escapes(arg))
+        return true;
+    return frame_escapes(*fcall->callee);
+  }
+  if (auto arr = std::get_if<ASTArray>(&ex.value)) {
+    for (auto &value : arr->values)
+      if (frame_escapes(value))
+        return true;
+  }
+  return false;
+}
+
+bool same_type(const ASTType &a, const ASTType &b) {
+  return a.name == b.name && a.count == b.count && a.soa == b.soa;
+}
+
+bool same_signature(const ASTFuncDeclare &a, const ASTFuncDeclare &b) {
+  if (!same_type(a.ret, b.ret) || a.args.size() != b.args.size())
+    return false;
+  for (size_t i = 0; i < a.args.size(); ++i)
+    if (!same_type(a.args[i].second, b.args[i].second))
+      return false;
+  // const pointers are a different C type.
+  return effects[a.name].read_only == effects[b.name].read_only;
+}
+
+void report_tail_call(Position pos, const std::string &callee,
+                      const std::string &what) {
+  if (codegen_options.tail_report)
+    std::cerr << source_location(pos) << ": tail call to " << callee << " "
+              << what << std::endl;
+}
+
+// Why a tail call from the current function can't reuse its frame, empty if
+// it can.
+std::string tail_call_blocker(const ASTFuncCall &fcall,
+                              const ASTFuncDeclare &callee) {
+  auto &caller = *current_function;
+  if (fcall.args.size() != callee.args.size())
+    return "has the wrong number of arguments";
+  if (caller.name == "main" || callee.name == "main")
+    return "involves main";
+  if (frame_escapes(caller.body))
+    return "is from a function with local arrays, maps or addresses of "
+           "locals";
+  for (auto &arg : fcall.args)
+    if (frame_escapes(arg))
+      return "passes an address";
+  return "";
+}
+
+// A self tail call evaluates the new arguments, stores them into the
+// parameters and jumps back to the start of the function.
+std::string generate_tail_loop(const ASTFuncCall &fcall) {
+  auto &params = current_function->args;
+  auto args = generate_args(fcall);
+  std::string res = "{\n", assign{};
+  for (size_t i = 0; i < params.size(); ++i) {
+    auto &name = params[i].first;
+    if (args[i] == name)
+      continue;
+    std::string tmp = "__inn_t" + std::to_string(i);
+    res += "__typeof__(" + name + ") " + tmp + " = " + args[i] + ";\n";
+    assign += name + " = " + tmp + ";\n";
+  }
+  tail_loop = true;
+  return res + assign + "goto __inn_tail;\n}\n";
+}
+
+// Tail calls are eliminated where they can be. Calls to the function itself
+// become a loop, which needs nothing from the C compiler. Other calls with
+// the same signature are marked musttail where the C compiler supports it.
+std::optional<std::string> generate_tail_call(const ASTFuncCall &fcall,
+                                              Position pos) {
+  std::string name = callee_name(fcall);
+  if (!functions.contains(name) || current_function == nullptr ||
+      lookup_var(name) || functions[name]->is_gen)
+    return std::nullopt;
+  auto &callee = *functions[name];
+  std::string blocker = tail_call_blocker(fcall, callee);
+  if (blocker.empty() && is_generic(callee)) {
+    // Only a call to the same instance can loop.
+    std::string error{};
+    auto bindings = bind_type_params(callee, fcall, error);
+    if (&callee != current_function || !bindings.has_value() ||
+        bindings.value() != type_bindings)
+      blocker = "is to another instance of a generic function";
+    else
+      name = mangle(callee, type_bindings);
+  }
+  if (blocker.empty() && &callee == current_function) {
+    for (size_t i = function_scope + 1; i < scopes.size(); ++i)
+      for (auto &param : callee.args)
+        if (scopes[i].vars.contains(param.first))
+          blocker = "is where parameter " + param.first + " is shadowed";
+  }
+  if (blocker.empty() && &callee == current_function) {
+    report_tail_call(pos, name, "eliminated, the function loops");
+    return generate_tail_loop(fcall);
   }
+  if (blocker.empty() && !same_signature(callee, *current_function))
+    blocker = "has a different signature from " + current_function->name;
+  if (blocker.empty()) {
+    report_tail_call(pos, name, "marked musttail");
+    uses_musttail = true;
+    // The returned expression has to be the bare call.
+    std::string res = "INN_MUSTTAIL return " + name + "(";
+    auto args = generate_args(fcall);
+    for (size_t i = 0; i < args.size(); ++i)
+      res += args[i] + (i != args.size() - 1 ? "," : "");
+    return res + ");";
+  }
+  report_tail_call(pos, name, "not eliminated, it " + blocker);
+  return std::nullopt;
+}
+
+// Calls to Inn functions inside a returned expression aren't tail calls.
+void report_inner_calls(const Expr &ex, Position pos) {
+  if (auto op = std::get_if<ASTOperation>(&ex.value)) {
+    if (op->left != nullptr)
+      report_inner_calls(*op->left, pos);
+    if (op->right != nullptr)
+      report_inner_calls(*op->right, pos);
+  } else if (auto fcall = std::get_if<ASTFuncCall>(&ex.value)) {
+    std::string name = callee_name(*fcall);
+    if (functions.contains(name))
+      report_tail_call(pos, name, "not eliminated, it isn't in tail position");
+    for (auto &arg : fcall->args)
+      report_inner_calls(arg, pos);
+  }
+}
+
+// Profiled functions are split into a body and a wrapper which does the
+// bookkeeping, so returns inside the body need no special treatment.
+std::string generate_profile_wrapper(const ASTFuncDeclare &stmt,
+                                     const std::string &name,
+                                     const std::string &body) {
+  std::string site = std::to_string(profile_funcs.size());
+  profile_funcs.push_back({name, stmt.pos});
+  bool is_void = stmt.ret.name == "void" && stmt.ret.count == 0;
+  std::string res{};
+  res += generate_signature(stmt, name) + ";\n";
+  res += "static inline " + generate_signature(stmt, "__inn_body_" + name);
+  res += " {\n" + body + "}\n";
+  res += generate_signature(stmt, name) + " {\n";
+  res += "unsigned long long __inn_t0 = inn_prof_now(), __inn_outer = "
+         "inn_prof_child;\n";
+  res += "inn_prof_child = 0;\n";
+  std::string call = "__inn_body_" + name + "(";
+  for (size_t i = 0; i < stmt.args.size(); ++i) {
+    call += c_param_name(stmt, i);
+    if (i != stmt.args.size() - 1)
+      call += ",";
+  }
+  call += ")";
+  if (is_void) {
+    res += call + ";\n";
+  } else {
+    res += "__typeof__(" + call + ") __inn_r = " + call + ";\n";
+  }
+  res += "inn_prof_leave(" + site + ", __inn_t0, __inn_outer);\n";
+  if (!is_void)
+    res += "return __inn_r;\n";
   res += "}\n";
   return res;
 }
 
+// Memo funcs are keyed by their arguments like maps are, by integers and
+// strings, and have to compute their result from them alone. Strings never
+// change, so reading them is fine.
+void check_memo(const ASTFuncDeclare &stmt) {
+  std::string what = "memo func " + stmt.name;
+  if (is_generic(stmt) || stmt.name == "main")
+    throw std::runtime_error(what + " can't be generic or main.");
+  if (stmt.args.empty())
+    throw std::runtime_error(what + " needs arguments to cache by.");
+  for (auto &[name, type] : stmt.args) {
+    ASTType var = resolve_type(type);
+    if (var.count != 0 ||
+        (var.name != "string" && (!numeric_types.contains(var.name) ||
+                                  numeric_types[var.name].is_float)))
+      throw std::runtime_error(what + " can only take integers and strings, " +
+                               name + " is " + type.name + ".");
+  }
+  ASTType ret = resolve_type(stmt.ret);
+  if (ret.name == "void" || ret.count != 0 || is_map(ret) || is_task(ret) ||
+      !types.contains(ret.name))
+    throw std::runtime_error(what + " can't cache values of type " +
+                             stmt.ret.name + ".");
+  std::string reason{};
+  Purity purity = call_purity(stmt, reason);
+  if (purity == Purity::Impure)
+    throw std::runtime_error(what + " has side effects, it " + reason + ".");
+  if (purity == Purity::Pure && !effects[stmt.name].changing.empty())
+    throw std::runtime_error(what + " reads memory which may change, it " +
+                             effects[stmt.name].changing + ".");
+}
+
+// Most arguments a memo func taking one integer caches in its array.
+constexpr long long memo_direct_limit = 1 << 20;
+
+bool memo_direct(const ASTFuncDeclare &stmt) {
+  return stmt.args.size() == 1 && resolve_type(stmt.args[0].second).name !=
+                                      "string";
+}
+
+// The key of a memo func's table holds its arguments, zeroed around them
+// so the padding compares equal too.
+void memo_typedefs(const ASTFuncDeclare &stmt, const std::string &m) {
+  require_runtime("map");
+  require_runtime("memo");
+  std::string key = "typedef struct {\n", hash{}, eq{};
+  for (auto &[name, type] : stmt.args) {
+    key += generate_type(type, name) + ";\n";
+    bool string = resolve_type(type).name == "string";
+    hash += "h = (h ^ " +
+            (string ? "inn_str_hash(k." + name + ")"
+                    : "(unsigned long long)k." + name) +
+            ") * 0x9e3779b97f4a7c15ull;\n";
+    eq += std::string(eq.empty() ? "" : " && ") +
+          (string ? "inn_str_eq(a." + name + ", b." + name + ")"
+                  : "a." + name + " == b." + name);
+  }
+  std::string value = generate_type(stmt.ret, "");
+  std::string def = key + "} " + m + "_key;\n";
+  def += "static inline unsigned long long " + m + "_hash(" + m +
+         "_key k) {\nunsigned long long h = 0;\n" + hash +
+         "return inn_map_hash_int(h);\n}\n";
+  def += "static inline int " + m + "_eq(" + m + "_key a, " + m +
+         "_key b) {\nreturn " + eq + ";\n}\n";
+  def += "INN_MAP_FUNCS(" + m + ", " + m + "_key, " + value + ", " + m +
+         "_hash, " + m + "_eq)\n";
+  if (memo_direct(stmt))
+    def += "INN_MEMO_DIRECT(" + m + "_direct, " + value + ")\n";
+  map_typedefs.push_back({m, def});
+}
+
+// A memo func's body becomes a static function, called by one with its name
+// which looks the arguments up first. The tables are per thread, so tasks
+// don't share them, and one with a bound starts over when it fills.
+std::string generate_memo_function(const ASTFuncDeclare &stmt,
+                                   const std::string &name,
+                                   const std::string &body) {
+  check_memo(stmt);
+  std::string m = "inn_memo_" + name, inner = "__inn_memo_" + name;
+  memo_typedefs(stmt, m);
+  std::string res = "static " + generate_signature(stmt, inner) + " {\n" +
+                    body + "}\n";
+  std::string args{}, ret = generate_type(stmt.ret, "");
+  for (size_t i = 0; i < stmt.args.size(); ++i)
+    args += (i == 0 ? "" : ",") + stmt.args[i].first;
+  std::string call = inner + "(" + args + ")", lookup{};
+  if (memo_direct(stmt)) {
+    long long limit = memo_direct_limit;
+    if (stmt.memo_bound > 0)
+      limit = std::min(limit, stmt.memo_bound);
+    std::string at = m + "_direct_at(&__inn_direct, " + stmt.args[0].first +
+                     ", " + std::to_string(limit) + ")";
+    lookup += "static __thread " + m + "_direct __inn_direct;\n" + m +
+              "_direct_entry *__inn_e = " + at + ";\n";
+    // The call may have grown the array.
+    lookup += "if (__inn_e) {\nif (!__inn_e->set) {\n" + ret + " __inn_r = " +
+              call + ";\n__inn_e = " + at +
+              ";\n__inn_e->val = __inn_r;\n__inn_e->set = 1;\n}\n"
+              "return __inn_e->val;\n}\n";
+  }
+  lookup += "static __thread " + m + " __inn_cache;\n" + m +
+            "_key __inn_k;\n__builtin_memset(&__inn_k, 0, sizeof(__inn_k));\n";
+  for (auto &arg : stmt.args)
+    lookup += "__inn_k." + arg.first + " = " + arg.first + ";\n";
+  lookup += m + "_slot *__inn_s = " + m +
+            "_find(&__inn_cache, __inn_k);\nif (__inn_s)\nreturn "
+            "__inn_s->val;\n" +
+            ret + " __inn_r = " + call + ";\n";
+  if (stmt.memo_bound > 0)
+    lookup += "if (__inn_cache.len >= " + std::to_string(stmt.memo_bound) +
+              ")\n" + m + "_clear(&__inn_cache);\n";
+  lookup += "*" + m + "_put(&__inn_cache, __inn_k) = __inn_r;\nreturn "
+            "__inn_r;\n";
+  if (codegen_options.profile)
+    return res + generate_profile_wrapper(stmt, name, lookup);
+  return res + generate_signature(stmt, name) + " {\n" + lookup + "}\n";
+}
+
+// inn_gen_NAME_next stores the generator's next value and returns 1, or
+// returns 0 once it has finished. It jumps back to where the last yield
+// left off.
+std::string generate_generator(const ASTFuncDeclare &stmt,
+                               const std::string &name) {
+  ASTType ret = resolve_type(stmt.ret);
+  if (ret.count != 0 || ret.name == "void")
+    throw std::runtime_error("Generator " + stmt.name +
+                             " has to yield single values.");
+  Generator &gen = generators[name];
+  generator_order.push_back(name);
+  current_gen = &gen;
+  scopes.emplace_back();
+  current_function = &stmt;
+  function_scope = scopes.size() - 1;
+  for (auto &[param, type] : stmt.args) {
+    if (type.soa)
+      throw std::runtime_error("soa arrays can't be passed to generator " +
+                               stmt.name + ".");
+    // Fixed size arrays and maps are kept as pointers, as they are passed.
+    ASTType field = type;
+    if (field.count > 0 || by_address(field))
+      field.count = -1;
+    gen.fields += generate_type(field, param) + ";\n";
+    declare_var(param, type,
+                by_address(type) ? "(*__inn_g->" + param + ")"
+                                 : "__inn_g->" + param);
+  }
+  std::string body = generate_block(stmt.body);
+  scopes.pop_back();
+  current_function = nullptr;
+  current_gen = nullptr;
+  std::string type = "inn_gen_" + name;
+  std::string sig = "static int " + type + "_next(" + type + " *__inn_g, " +
+                    generate_type(ret, "*__inn_out") + ")";
+  gen.def = "typedef struct {\nint __inn_state;\n" + gen.fields + "} " +
+            type + ";\n" + sig + ";\nstatic inline void " + type +
+            "_release(" + type + " *__inn_g) {\n" + gen.release + "}\n";
+  std::string res = line_directive(stmt.pos) + sig +
+                    " {\nswitch (__inn_g->__inn_state) {\ncase 0:\nbreak;\n";
+  for (size_t k = 1; k <= gen.resumes; ++k)
+    res += "case " + std::to_string(k) + ":\ngoto __inn_resume" +
+           std::to_string(k) + ";\n";
+  res += "default:\nreturn 0;\n}\n" + body;
+  return res + "__inn_g->__inn_state = -1;\nreturn 0;\n}\n";
+}
+
+// Generates `stmt` as the C function `name`, which differs for instances of
+// generic functions.
+std::string generate_function(const ASTFuncDeclare &stmt,
+                              const std::string &name) {
+  if (stmt.is_gen)
+    return generate_generator(stmt, name);
+  scopes.emplace_back();
+  current_function = &stmt;
+  function_scope = scopes.size() - 1;
+  tail_loop = false;
+  std::string body{};
+  for (size_t i = 0; i < stmt.args.size(); ++i) {
+    auto &arg = stmt.args[i];
+    declare_var(arg.first, arg.second,
+                by_address(arg.second) ? "(*" + arg.first + ")" : "");
+    if (is_c_argv(stmt, i)) {
+      require_runtime("string");
+      body += "inn_str *" + stmt.args[i].first + " = inn_str_argv(" +
+              stmt.args[0].first + ", " + c_param_name(stmt, i) + ");\n";
+    }
+  }
+  std::string block = generate_block(stmt.body);
+  if (tail_loop)
+    body += "__inn_tail:;\n";
+  body += block;
+  scopes.pop_back();
+  current_function = nullptr;
+  if (stmt.is_memo)
+    return line_directive(stmt.pos) +
+           generate_memo_function(stmt, name, body);
+  if (codegen_options.profile)
+    return line_directive(stmt.pos) +
+           generate_profile_wrapper(stmt, name, body);
+  return line_directive(stmt.pos) + generate_signature(stmt, name) + " {\n" +
+         body + "}\n";
+}
+
+// Generic functions are only generated once instantiated.
+std::string generate_one(const ASTFuncDeclare &stmt) {
+  if (compile_time_only(stmt) || is_generic(stmt))
+    return "";
+  return generate_function(stmt, stmt.name);
+}
+
+std::string generate_instance(const std::string &name) {
+  auto &inst = instances[name];
+  type_bindings = inst.bindings;
+  std::string res = generate_at(
+      inst.fdecl->pos, [&] { return generate_function(*inst.fdecl, name); });
+  type_bindings.clear();
+  return res;
+}
+
 std::string generate_one(const ASTBreak &) { return "break;"; }
 
+std::string generate_one(const ASTYield &yld) {
+  if (current_gen == nullptr)
+    throw std::runtime_error("yield is only allowed in a gen func.");
+  std::string k = std::to_string(++current_gen->resumes);
+  return "*__inn_out = " + generate_typed(yld.what, current_function->ret) +
+         ";\n__inn_g->__inn_state = " + k + ";\nreturn 1;\n__inn_resume" +
+         k + ":;\n";
+}
+
+// for k in map_keys(m) walks the slots of m in place. Entries added while
+// it runs may or may not come up.
+std::string generate_map_loop(const ASTFor &loop, const ASTFuncCall &fcall) {
+  std::string name = callee_name(fcall);
+  auto map = fcall.args.size() == 1 ? infer_type(fcall.args[0])
+                                    : std::nullopt;
+  if (!is_map(map) || map->count != 0)
+    throw std::runtime_error(name + " expects (map).");
+  std::string field = name == "map_keys" ? "key" : "val";
+  ASTType elem = name == "map_keys" ? map_key(*map) : map_value(*map);
+  std::string target = "&" + generate_one(fcall.args[0]);
+  std::string res = "{\n", at{}, slot{};
+  scopes.emplace_back();
+  if (current_gen != nullptr) {
+    at = gen_field("__inn_map", ASTType{map->name, -1});
+    slot = gen_field("__inn_slot", ASTType{"i64", 0});
+    declare_var(loop.name, elem, gen_field(loop.name, elem));
+  } else {
+    at = "__inn_map" + std::to_string(scopes.size());
+    slot = "__inn_slot" + std::to_string(scopes.size());
+    res += generate_type(ASTType{map->name, -1}, at) + ";\nlong long " + slot +
+           ";\n" + generate_type(elem, loop.name) + ";\n";
+    declare_var(loop.name, elem);
+  }
+  std::string next = "inn_map_next(" + at + "->ctrl, " + at + "->cap, ";
+  res += at + " = " + target + ";\nfor (" + slot + " = " + next + "0); " +
+         slot + " < " + at + "->cap; " + slot + " = " + next + slot +
+         " + 1)) {\n" + var_c_name(loop.name) + " = " + at + "->slots[" +
+         slot + "]." + field + ";\n";
+  res += profile_trip(loop.pos);
+  res += generate_block(loop.body) + "}\n}\n";
+  scopes.pop_back();
+  return res;
+}
+
+// The generator's state lives in the loop, or in the enclosing generator's
+// state if the loop is in one, so values are made one at a time with no
+// allocation. Heap arrays of the generators are freed when the loop ends,
+// however it's left.
+std::string generate_one(const ASTFor &loop) {
+  auto fcall = std::get_if<ASTFuncCall>(&loop.source.value);
+  std::string name = fcall != nullptr ? callee_name(*fcall) : "";
+  if ((name == "map_keys" || name == "map_values") &&
+      !functions.contains(name) && !lookup_var(name))
+    return generate_map_loop(loop, *fcall);
+  if (fcall == nullptr || !functions.contains(name) || lookup_var(name) ||
+      !functions[name]->is_gen)
+    throw std::runtime_error("for ... in needs a call to a gen func, "
+                             "map_keys or map_values.");
+  auto &gdecl = *functions[name];
+  if (fcall->args.size() != gdecl.args.size())
+    throw std::runtime_error("Call to generator " + name +
+                             " has the wrong number of arguments.");
+  if (is_generic(gdecl))
+    name = instantiate(*fcall);
+  ASTType elem = infer_type(loop.source).value();
+  std::string type = "inn_gen_" + name;
+  auto args = generate_args(*fcall);
+  std::string init = "(" + type + "){.__inn_state = 0";
+  for (size_t i = 0; i < args.size(); ++i)
+    init += ", ." + gdecl.args[i].first + " = " + args[i];
+  init += "}";
+  std::string res = "{\n", state{};
+  scopes.emplace_back();
+  if (current_gen != nullptr) {
+    std::string field = "__inn_gen" + std::to_string(current_gen->locals++);
+    current_gen->fields += type + " " + field + ";\n";
+    current_gen->embeds.push_back(name);
+    current_gen->release += type + "_release(&__inn_g->" + field + ");\n";
+    state = "__inn_g->" + field;
+    declare_var(loop.name, elem, gen_field(loop.name, elem));
+    res += state + " = " + init + ";\n";
+  } else {
+    state = "__inn_gen" + std::to_string(scopes.size());
+    res += type + " " + state + " __attribute__((cleanup(" + type +
+           "_release))) = " + init + ";\n" + generate_type(elem, loop.name) +
+           ";\n";
+    declare_var(loop.name, elem);
+  }
+  res += "while (" + type + "_next(&" + state + ", &" +
+         var_c_name(loop.name) + ")) {\n";
+  res += profile_trip(loop.pos);
+  res += generate_block(loop.body) + "}\n";
+  if (current_gen != nullptr)
+    res += type + "_release(&" + state + ");\n";
+  res += "}\n";
+  scopes.pop_back();
+  return res;
+}
+
 std::string generate_one(const ASTReturn &ret) {
+  if (current_gen != nullptr && ret.what.has_value())
+    throw std::runtime_error("Generators can only return without a value.");
+  if (current_gen != nullptr)
+    return "__inn_g->__inn_state = -1;\nreturn 0;";
   std::string res{"return "};
-  if (ret.what.has_value())
+  if (ret.what.has_value()) {
+    if (auto fcall = std::get_if<ASTFuncCall>(&ret.what->value)) {
+      if (auto tail = generate_tail_call(*fcall, ret.pos))
+        return tail.value();
+      for (auto &arg : fcall->args)
+        report_inner_calls(arg, ret.pos);
+    } else {
+      report_inner_calls(ret.what.value(), ret.pos);
+    }
     res += generate_one(ret.what.value());
+  }
   res += ";";
   return res;
 }
 
 std::string generate_one(const Statement &stmt) {
   if (std::holds_alternative<Expr>(stmt.value)) {
+    auto op = std::get_if<ASTOperation>(&std::get<Expr>(stmt.value).value);
+    if (op != nullptr && op->op == Operator::Assign) {
+      auto target = infer_type(*op->left);
+      if (is_array(target) &&
+          !std::holds_alternative<ASTArray>(op->right->value))
+        return generate_array_assign(generate_one(*op->left), target.value(),
+                                     *op->right, op->left.get());
+    }
     return generate_one(std::get<Expr>(stmt.value)) + ";\n";
   }
 
@@ -228,6 +3433,13 @@ std::string generate_one(const Statement &stmt) {
                     stmt.value);
 }
 
+std::string generate_one(const ASTStructDeclare &sdecl) {
+  std::string res = "typedef struct " + sdecl.name + " {\n";
+  for (auto &field : sdecl.fields)
+    res += generate_type(field.second, field.first) + ";\n";
+  return res + "} " + sdecl.name + ";\n";
+}
+
 // Why? No clue, need this explicitly.
 struct GenerateOneVisitor {
   std::string operator()(const Statement &stmt) const {
@@ -236,12 +3448,164 @@ struct GenerateOneVisitor {
   std::string operator()(const ASTFuncDeclare &f) const {
     return generate_one(f);
   }
+  std::string operator()(const ASTStructDeclare &s) const {
+    return generate_one(s);
+  }
 };
 
 std::string generate_one(const Paragraph &para) {
-  return std::visit(GenerateOneVisitor{}, para);
+  Position pos = std::visit([](auto &arg) { return arg.pos; }, para);
+  return generate_at(pos, [&] { return std::visit(GenerateOneVisitor{}, para); });
 }
 
 std::string begin_file() {
-  return "#include <math.h>\n#include<stdio.h>\n#include<stdlib.h>\n";
+  return "#include <math.h>\n#include <stdint.h>\n#include<stdio.h>\n"
+         "#include<stdlib.h>\n";
+}
+
+std::string generate_profile_tables() {
+  std::string res{};
+  // The counts are totals over all threads, added up by the report.
+  res += "typedef struct {\nconst char *name;\nconst char *loc;\n"
+         "unsigned long long calls, incl, excl;\n} inn_prof_func;\n";
+  res += "typedef struct {\nconst char *loc;\nunsigned long long trips;\n} "
+         "inn_prof_loop;\n";
+  res += "#define INN_PROF_NFUNCS " + std::to_string(profile_funcs.size()) +
+         "\n";
+  res += "#define INN_PROF_NLOOPS " + std::to_string(profile_loops.size()) +
+         "\n";
+  // Trailing zero entry keeps the arrays non-empty.
+  res += "static inn_prof_func inn_prof_funcs[] = {\n";
+  for (auto &site : profile_funcs)
+    res += "{" + quote(site.name) + "," + quote(source_location(site.pos)) +
+           "},\n";
+  res += "{0}};\n";
+  res += "static inn_prof_loop inn_prof_loops[] = {\n";
+  for (auto &site : profile_loops)
+    res += "{" + quote(source_location(site.pos)) + "},\n";
+  res += "{0}};\n";
+  return res;
+}
+
+// Generators hold the state of those they run, so those are defined first.
+void generator_defs(const std::string &name,
+                    std::unordered_set<std::string> &open,
+                    std::unordered_set<std::string> &done, std::string &res) {
+  if (done.contains(name))
+    return;
+  if (open.contains(name))
+    throw std::runtime_error("Generator " + name + " runs itself, which "
+                             "would need unbounded state.");
+  open.insert(name);
+  for (auto &inner : generators[name].embeds)
+    generator_defs(inner, open, done, res);
+  open.erase(name);
+  done.insert(name);
+  res += generators[name].def;
+}
+
+std::string generate_program(const std::vector<Paragraph> &roots) {
+  evaluator.find_function = [](const std::string &name) {
+    auto it = functions.find(name);
+    return it != functions.end() ? it->second : nullptr;
+  };
+  evaluator.find_const = const_value;
+  for (auto &para : roots) {
+    if (auto fdecl = std::get_if<ASTFuncDeclare>(&para))
+      functions[fdecl->name] = fdecl;
+    if (auto sdecl = std::get_if<ASTStructDeclare>(&para)) {
+      structs[sdecl->name] = sdecl;
+      types[sdecl->name] = sdecl->name;
+    }
+  }
+  analyze_effects(roots);
+  if (codegen_options.effects_report)
+    report_effects(roots);
+  // Struct definitions go first so every function can use them.
+  std::string decls{};
+  for (auto &para : roots) {
+    if (std::holds_alternative<ASTStructDeclare>(para))
+      decls += generate_one(para);
+  }
+  std::string body{};
+  for (auto &para : roots) {
+    if (!std::holds_alternative<ASTStructDeclare>(para))
+      body += generate_one(para);
+  }
+  // Instances can instantiate further generics, so the order grows as we go.
+  for (size_t i = 0; i < instance_order.size(); ++i)
+    body += generate_instance(instance_order[i]);
+  for (auto &def : soa_typedefs)
+    decls += def.second;
+  std::unordered_set<std::string> open{}, done{};
+  for (auto &name : generator_order)
+    generator_defs(name, open, done, decls);
+  // Prototypes let functions call each other regardless of order, which
+  // mutual tail calls need.
+  // The rest of a library is hidden, see the compile command.
+  for (auto &para : roots)
+    if (auto fdecl = std::get_if<ASTFuncDeclare>(&para))
+      if (!compile_time_only(*fdecl) && !is_generic(*fdecl) && !fdecl->is_gen)
+        decls += std::string(exported(*fdecl) ? "__attribute__((visibility("
+                                                "\"default\"))) "
+                                              : "") +
+                 generate_signature(*fdecl, fdecl->name) + ";\n";
+  for (auto &name : instance_order) {
+    if (instances[name].fdecl->is_gen)
+      continue;
+    type_bindings = instances[name].bindings;
+    decls += generate_signature(*instances[name].fdecl, name) + ";\n";
+    type_bindings.clear();
+  }
+  for (auto &name : task_wrapper_order)
+    decls += task_wrappers[name];
+  // Map operations are library code, optimized even in -O0 builds. Profiled
+  // builds define INN_PGO and compile everything at -O2 instead.
+  if (!map_typedefs.empty())
+    decls += "#ifndef INN_PGO\n#pragma GCC push_options\n"
+             "#pragma GCC optimize(\"O2\")\n#endif\n";
+  for (auto &def : map_typedefs)
+    decls += def.second;
+  if (!map_typedefs.empty())
+    decls += "#ifndef INN_PGO\n#pragma GCC pop_options\n#endif\n";
+  std::string res = begin_file();
+  for (auto &module : runtime_modules)
+    res += runtime_source(module);
+  res += generate_string_literals();
+  for (auto &def : map_typedefs)
+    res += "INN_MAP_TYPE(" + def.first + ")\n";
+  res += decls;
+  if (uses_musttail)
+    res += "#ifdef __has_attribute\n#if __has_attribute(musttail)\n"
+           "#define INN_MUSTTAIL __attribute__((musttail))\n#endif\n#endif\n"
+           "#ifndef INN_MUSTTAIL\n#define INN_MUSTTAIL\n#endif\n";
+  if (codegen_options.profile)
+    res += generate_profile_tables() + profile_runtime();
+  // The body goes last, so the #line directives in it only cover Inn code.
+  res += body;
+  return res;
+}
+
+// Where --shared writes the header of a library built at `output`.
+std::string header_path(const std::string &output) {
+  return std::filesystem::path(output).replace_extension(".h").string();
+}
+
+// The header of a --shared library declares its exported funcs and the
+// structs they can use, as C which C++ can include too. Call after
+// generate_program.
+std::string generate_header(const std::vector<Paragraph> &roots) {
+  std::string res = "// Generated by inn --shared from " +
+                    codegen_options.source_name +
+                    ".\n#pragma once\n#include <stdint.h>\n\n"
+                    "#ifdef __cplusplus\nextern \"C\" {\n#endif\n\n";
+  for (auto &para : roots)
+    if (auto sdecl = std::get_if<ASTStructDeclare>(&para))
+      if (c_abi_type(ASTType{sdecl->name, 0}))
+        res += generate_one(*sdecl);
+  for (auto &para : roots)
+    if (auto fdecl = std::get_if<ASTFuncDeclare>(&para))
+      if (exported(*fdecl))
+        res += generate_signature(*fdecl, fdecl->name) + ";\n";
+  return res + "\n#ifdef __cplusplus\n}\n#endif\n";
 }
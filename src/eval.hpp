@@ -0,0 +1,451 @@
+#pragma once
+
+#include "ast.hpp"
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// A value computed while compiling: an int, a float or an array of values.
+struct Value {
+  std::variant<int, float, std::vector<Value>> v;
+};
+
+// Something a const func did which can't be done while compiling.
+struct EvalError : std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+std::string c_value(const Value &value) {
+  if (auto i = std::get_if<int>(&value.v)) {
+    if (*i == INT32_MIN)
+      return "(-2147483647-1)";
+    return std::to_string(*i);
+  }
+  if (auto f = std::get_if<float>(&value.v)) {
+    if (!std::isfinite(*f))
+      throw EvalError("Constant float isn't finite.");
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.9g", *f);
+    std::string res = buf;
+    if (res.find_first_of(".e") == std::string::npos)
+      res += ".0";
+    return res + "f";
+  }
+  auto &arr = std::get<std::vector<Value>>(value.v);
+  std::string res = "{";
+  for (size_t i = 0; i < arr.size(); ++i) {
+    res += c_value(arr[i]);
+    if (i != arr.size() - 1)
+      res += ",";
+  }
+  return res + "}";
+}
+
+// Converts like assigning in C would.
+Value convert(const Value &value, const ASTType &type) {
+  if (type.count > 0 && !type.soa) {
+    auto arr = std::get_if<std::vector<Value>>(&value.v);
+    if (arr == nullptr || arr->size() != (size_t)type.count)
+      throw EvalError("Expected an array of " + std::to_string(type.count) +
+                      " " + type.name + ".");
+    std::vector<Value> res{};
+    for (auto &elem : *arr)
+      res.push_back(convert(elem, ASTType{type.name, 0}));
+    return Value{std::move(res)};
+  }
+  if (type.count != 0 || (type.name != "int" && type.name != "float"))
+    throw EvalError("Const funcs only work on int, float and arrays of them.");
+  if (std::holds_alternative<std::vector<Value>>(value.v))
+    throw EvalError("Expected a single " + type.name + ", got an array.");
+  if (type.name == "int") {
+    if (auto f = std::get_if<float>(&value.v)) {
+      if (!(*f > -2147483649.0f && *f < 2147483648.0f))
+        throw EvalError("Float doesn't fit in an int.");
+      return Value{(int)*f};
+    }
+    return value;
+  }
+  if (auto i = std::get_if<int>(&value.v))
+    return Value{(float)*i};
+  return value;
+}
+
+Value zero_value(const ASTType &type) {
+  if (type.count > 0 && !type.soa)
+    return Value{std::vector<Value>(type.count, zero_value({type.name, 0}))};
+  return convert(Value{0}, type);
+}
+
+// Runs const funcs over the AST while compiling. Integers wrap like C ints
+// do in practice and floats are single precision, so results match what the
+// program would have computed at run time.
+class Evaluator {
+public:
+  // Any function by name, nullptr if there's none.
+  std::function<const ASTFuncDeclare *(const std::string &)> find_function;
+  // Constants visible where evaluation started, or only file scope ones
+  // from inside a const func.
+  std::function<const Value *(const std::string &, bool)> find_const;
+
+  Value eval_call(const ASTFuncCall &fcall) {
+    steps = 0;
+    return call(fcall);
+  }
+
+  Value eval_const(const Expr &ex) {
+    steps = 0;
+    return eval(ex);
+  }
+
+private:
+  struct Slot {
+    ASTType type;
+    Value value;
+  };
+  enum class Flow { Next, Break, Return };
+
+  static constexpr long long max_steps = 50'000'000;
+  static constexpr int max_depth = 1000;
+
+  std::vector<std::unordered_map<std::string, Slot>> scopes{};
+  size_t base = 0; // First scope of the innermost call
+  int depth = 0;
+  long long steps = 0;
+  Value ret{0};
+
+  void step() {
+    if (++steps > max_steps)
+      throw EvalError("Evaluation took too long.");
+  }
+
+  Slot *find_local(const std::string &name) {
+    for (size_t i = scopes.size(); i > base; --i) {
+      auto it = scopes[i - 1].find(name);
+      if (it != scopes[i - 1].end())
+        return &it->second;
+    }
+    return nullptr;
+  }
+
+  Value call(const ASTFuncCall &fcall) {
+    auto sing = std::get_if<ASTSingular>(&fcall.callee->value);
+    auto sym = sing != nullptr ? std::get_if<ASTSymbol>(sing) : nullptr;
+    const ASTFuncDeclare *fn = sym != nullptr ? find_function(sym->value)
+                                              : nullptr;
+    if (fn == nullptr || !fn->is_const)
+      throw EvalError((sym != nullptr ? sym->value : "Callee") +
+                      " isn't a const func.");
+    if (fcall.args.size() != fn->args.size())
+      throw EvalError(fn->name + " expects " +
+                      std::to_string(fn->args.size()) + " arguments.");
+    if (depth == max_depth)
+      throw EvalError("Recursion too deep in " + fn->name + ".");
+    std::unordered_map<std::string, Slot> params{};
+    for (size_t i = 0; i < fn->args.size(); ++i) {
+      auto &type = fn->args[i].second;
+      params[fn->args[i].first] = {type, convert(eval(fcall.args[i]), type)};
+    }
+    size_t outer = base;
+    base = scopes.size();
+    scopes.push_back(std::move(params));
+    ++depth;
+    Flow flow = Flow::Next;
+    try {
+      flow = exec(fn->body, false);
+    } catch (...) {
+      scopes.resize(base);
+      base = outer;
+      --depth;
+      throw;
+    }
+    scopes.resize(base);
+    base = outer;
+    --depth;
+    if (fn->ret.name == "void" && fn->ret.count == 0)
+      return Value{0};
+    if (flow != Flow::Return)
+      throw EvalError(fn->name + " ended without returning a value.");
+    return convert(ret, fn->ret);
+  }
+
+  Flow exec(const std::vector<Statement> &body, bool scoped = true) {
+    if (scoped)
+      scopes.emplace_back();
+    Flow flow = Flow::Next;
+    for (auto &stmt : body) {
+      flow = exec(stmt);
+      if (flow != Flow::Next)
+        break;
+    }
+    if (scoped)
+      scopes.pop_back();
+    return flow;
+  }
+
+  Flow exec(const Statement &stmt) {
+    step();
+    if (auto decl = std::get_if<ASTVarDeclare>(&stmt.value)) {
+      Value value = decl->value.has_value()
+                        ? convert(eval(decl->value.value()), decl->type)
+                        : zero_value(decl->type);
+      scopes.back()[decl->name] = {decl->type, std::move(value)};
+      return Flow::Next;
+    }
+    if (auto ex = std::get_if<Expr>(&stmt.value)) {
+      eval(*ex);
+      return Flow::Next;
+    }
+    if (auto whl = std::get_if<ASTWhile>(&stmt.value)) {
+      while (truthy(eval(whl->condition))) {
+        Flow flow = exec(whl->body);
+        if (flow == Flow::Break)
+          break;
+        if (flow == Flow::Return)
+          return flow;
+      }
+      return Flow::Next;
+    }
+    if (auto ifs = std::get_if<ASTIf>(&stmt.value)) {
+      for (auto &branch : ifs->branches)
+        if (truthy(eval(branch.first)))
+          return exec(branch.second);
+      return exec(ifs->otherwise);
+    }
+    if (std::holds_alternative<ASTBreak>(stmt.value))
+      return Flow::Break;
+    if (!std::holds_alternative<ASTReturn>(stmt.value))
+      throw EvalError("Generators only run at run time.");
+    auto &r = std::get<ASTReturn>(stmt.value);
+    ret = r.what.has_value() ? eval(r.what.value()) : Value{0};
+    return Flow::Return;
+  }
+
+  static bool truthy(const Value &value) {
+    if (auto i = std::get_if<int>(&value.v))
+      return *i != 0;
+    if (auto f = std::get_if<float>(&value.v))
+      return *f != 0;
+    throw EvalError("An array isn't a condition.");
+  }
+
+  static int index_of(const Value &idx, size_t size) {
+    auto i = std::get_if<int>(&idx.v);
+    if (i == nullptr)
+      throw EvalError("Array indices have to be ints.");
+    if (*i < 0 || (size_t)*i >= size)
+      throw EvalError("Index " + std::to_string(*i) + " out of bounds for [" +
+                      std::to_string(size) + "].");
+    return *i;
+  }
+
+  // The slot or element written by an assignment, and its type.
+  std::pair<Value *, ASTType> lvalue(const Expr &ex) {
+    if (auto sing = std::get_if<ASTSingular>(&ex.value)) {
+      if (auto sym = std::get_if<ASTSymbol>(sing)) {
+        Slot *slot = find_local(sym->value);
+        if (slot == nullptr)
+          throw EvalError("Cannot assign to " + sym->value +
+                          " while compiling.");
+        return {&slot->value, slot->type};
+      }
+    }
+    auto op = std::get_if<ASTOperation>(&ex.value);
+    if (op != nullptr && op->op == Operator::Index && op->right != nullptr) {
+      Value idx = eval(*op->right);
+      auto [base, type] = lvalue(*op->left);
+      auto arr = std::get_if<std::vector<Value>>(&base->v);
+      if (arr == nullptr)
+        throw EvalError("Only arrays can be indexed.");
+      return {&(*arr)[index_of(idx, arr->size())], ASTType{type.name, 0}};
+    }
+    throw EvalError("Cannot assign to this while compiling.");
+  }
+
+  // Where a variable or an element of one is stored, so reading an element
+  // doesn't copy the whole array. nullptr for other expressions.
+  const Value *place(const Expr &ex) {
+    if (auto sing = std::get_if<ASTSingular>(&ex.value)) {
+      auto sym = std::get_if<ASTSymbol>(sing);
+      if (sym == nullptr)
+        return nullptr;
+      if (Slot *slot = find_local(sym->value))
+        return &slot->value;
+      return find_const(sym->value, depth > 0);
+    }
+    auto op = std::get_if<ASTOperation>(&ex.value);
+    if (op == nullptr || op->op != Operator::Index || op->right == nullptr)
+      return nullptr;
+    Value idx = eval(*op->right);
+    const Value *base = place(*op->left);
+    auto arr = base != nullptr ? std::get_if<std::vector<Value>>(&base->v)
+                               : nullptr;
+    if (arr == nullptr)
+      return nullptr;
+    return &(*arr)[index_of(idx, arr->size())];
+  }
+
+  static Value arith(Operator op, const Value &a, const Value &b) {
+    auto aa = std::get_if<std::vector<Value>>(&a.v);
+    auto ba = std::get_if<std::vector<Value>>(&b.v);
+    if (aa != nullptr || ba != nullptr) {
+      // Element by element, like whole-array arithmetic at run time.
+      size_t n = aa != nullptr ? aa->size() : ba->size();
+      if (aa != nullptr && ba != nullptr && aa->size() != ba->size())
+        throw EvalError("Array extents differ.");
+      std::vector<Value> res{};
+      for (size_t i = 0; i < n; ++i)
+        res.push_back(arith(op, aa != nullptr ? (*aa)[i] : a,
+                            ba != nullptr ? (*ba)[i] : b));
+      return Value{std::move(res)};
+    }
+    auto ai = std::get_if<int>(&a.v), bi = std::get_if<int>(&b.v);
+    if (ai != nullptr && bi != nullptr) {
+      uint32_t x = (uint32_t)*ai, y = (uint32_t)*bi;
+      switch (op) {
+      case Operator::Add:
+        return Value{(int)(x + y)};
+      case Operator::Sub:
+        return Value{(int)(x - y)};
+      case Operator::Mul:
+        return Value{(int)(x * y)};
+      case Operator::Div:
+        if (*bi == 0 || (*ai == INT32_MIN && *bi == -1))
+          throw EvalError("Integer division by zero or overflow.");
+        return Value{*ai / *bi};
+      case Operator::Equal:
+        return Value{(int)(*ai == *bi)};
+      case Operator::Greater:
+        return Value{(int)(*ai > *bi)};
+      case Operator::GreaterEq:
+        return Value{(int)(*ai >= *bi)};
+      case Operator::Less:
+        return Value{(int)(*ai < *bi)};
+      case Operator::LessEq:
+        return Value{(int)(*ai <= *bi)};
+      default:
+        break;
+      }
+    } else {
+      float x = ai != nullptr ? (float)*ai : std::get<float>(a.v);
+      float y = bi != nullptr ? (float)*bi : std::get<float>(b.v);
+      switch (op) {
+      case Operator::Add:
+        return Value{x + y};
+      case Operator::Sub:
+        return Value{x - y};
+      case Operator::Mul:
+        return Value{x * y};
+      case Operator::Div:
+        return Value{x / y};
+      case Operator::Equal:
+        return Value{(int)(x == y)};
+      case Operator::Greater:
+        return Value{(int)(x > y)};
+      case Operator::GreaterEq:
+        return Value{(int)(x >= y)};
+      case Operator::Less:
+        return Value{(int)(x < y)};
+      case Operator::LessEq:
+        return Value{(int)(x <= y)};
+      default:
+        break;
+      }
+    }
+    throw EvalError("Operator isn't supported while compiling.");
+  }
+
+  static Value negate(const Value &value) {
+    if (auto arr = std::get_if<std::vector<Value>>(&value.v)) {
+      std::vector<Value> res{};
+      for (auto &elem : *arr)
+        res.push_back(negate(elem));
+      return Value{std::move(res)};
+    }
+    if (auto i = std::get_if<int>(&value.v))
+      return Value{(int)(0u - (uint32_t)*i)};
+    return Value{-std::get<float>(value.v)};
+  }
+
+  Value eval(const ASTOperation &op) {
+    switch (op.op) {
+    case Operator::Assign: {
+      Value value = eval(*op.right);
+      auto [slot, type] = lvalue(*op.left);
+      *slot = convert(value, type);
+      return *slot;
+    }
+    case Operator::And:
+      return Value{truthy(eval(*op.left)) && truthy(eval(*op.right)) ? 1 : 0};
+    case Operator::Or:
+      return Value{truthy(eval(*op.left)) || truthy(eval(*op.right)) ? 1 : 0};
+    case Operator::Not:
+      return Value{(int)!truthy(eval(*op.right))};
+    case Operator::Pos:
+      return eval(*op.right);
+    case Operator::Neg:
+      return negate(eval(*op.right));
+    case Operator::Index: {
+      if (op.right == nullptr)
+        throw EvalError("Pointers aren't supported while compiling.");
+      Value idx = eval(*op.right);
+      Value temp{};
+      const Value *base = place(*op.left);
+      if (base == nullptr) {
+        temp = eval(*op.left);
+        base = &temp;
+      }
+      auto arr = std::get_if<std::vector<Value>>(&base->v);
+      if (arr == nullptr)
+        throw EvalError("Only arrays can be indexed.");
+      return (*arr)[index_of(idx, arr->size())];
+    }
+    case Operator::Ref:
+      throw EvalError("Pointers aren't supported while compiling.");
+    case Operator::Member:
+      throw EvalError("Structs aren't supported while compiling.");
+    case Operator::Spawn:
+      throw EvalError("Tasks aren't supported while compiling.");
+    default:
+      return arith(op.op, eval(*op.left), eval(*op.right));
+    }
+  }
+
+  Value eval(const Expr &ex) {
+    step();
+    if (auto sing = std::get_if<ASTSingular>(&ex.value)) {
+      if (auto i = std::get_if<ASTInt>(sing)) {
+        if (i->type != "int")
+          throw EvalError("Only int and float are computed while compiling.");
+        return Value{(int)i->value};
+      }
+      if (auto f = std::get_if<ASTFloat>(sing)) {
+        if (f->type != "float")
+          throw EvalError("Only int and float are computed while compiling.");
+        return Value{(float)f->value};
+      }
+      if (std::holds_alternative<ASTString>(*sing))
+        throw EvalError("Strings aren't supported while compiling.");
+      auto &name = std::get<ASTSymbol>(*sing).value;
+      if (Slot *slot = find_local(name))
+        return slot->value;
+      if (auto value = find_const(name, depth > 0))
+        return *value;
+      throw EvalError(name + " isn't a constant.");
+    }
+    if (auto op = std::get_if<ASTOperation>(&ex.value))
+      return eval(*op);
+    if (auto arr = std::get_if<ASTArray>(&ex.value)) {
+      std::vector<Value> res{};
+      for (auto &value : arr->values)
+        res.push_back(eval(value));
+      return Value{std::move(res)};
+    }
+    return call(std::get<ASTFuncCall>(ex.value));
+  }
+};
@@ -1,4 +1,5 @@
 #include "lexer.hpp"
+#include <algorithm>
 #include <cctype>
 #include <stdexcept>
 #include <string>
@@ -11,34 +12,47 @@ static std::unordered_map<std::string, TokenType> keywords{
     {"var", TokenType::KwVar},       {"if", TokenType::KwIf},
     {"while", TokenType::KwWhile},   {"do", TokenType::KwDo},
     {"end", TokenType::KwEnd},       {"else", TokenType::KwElse},
-    {"return", TokenType::KwReturn}, {"break", TokenType::KwBreak}};
+    {"return", TokenType::KwReturn}, {"break", TokenType::KwBreak},
+    {"struct", TokenType::KwStruct}, {"soa", TokenType::KwSoa},
+    {"const", TokenType::KwConst},   {"spawn", TokenType::KwSpawn},
+    {"gen", TokenType::KwGen},       {"yield", TokenType::KwYield},
+    {"for", TokenType::KwFor},       {"in", TokenType::KwIn},
+    {"memo", TokenType::KwMemo}};
 
 bool is_symbol(char c) {
   return isalnum(c) || c == '_' || c == '!' || c == '?';
 }
 
+const std::vector<uint32_t> &LineTable::lines() {
+  if (starts.empty()) {
+    starts.push_back(0);
+    for (size_t i = 0; i < src.size(); ++i)
+      if (src[i] == '\n')
+        starts.push_back(i + 1);
+  }
+  return starts;
+}
+
+std::pair<int, int> LineTable::locate(Position pos) {
+  lines();
+  auto line = std::upper_bound(starts.begin(), starts.end(), pos.offset) - 1;
+  return {line - starts.begin() + 1, pos.offset - *line + 1};
+}
+
 void Tokenizer::add_token(TokenType type, const std::string &lexeme) {
-  // Not actually accurate :)
-  tokens.emplace_back(type, lexeme, Position(row, col - (int)lexeme.size()));
+  tokens.emplace_back(type, lexeme, Position{base + (uint32_t)start});
 };
 
 void Tokenizer::tokenize() {
   while (i < src.size()) {
     char c = src[i];
 
-    if (c == '\n') {
-      row++;
-      col = 1;
-      i++;
-      continue;
-    }
-
     if (isspace(c)) {
       i++;
-      col++;
       continue;
     }
 
+    start = i;
     if (c == '#') {
       std::string comment;
       while (i < src.size() && src[i] != '\n') {
@@ -53,10 +67,8 @@ void Tokenizer::tokenize() {
     } else if (try_symbolic()) {
     } else if (try_string()) {
     } else {
-      throw std::runtime_error("Unknown character");
+      throw SourceError(here(), "Unknown character.");
     }
-
-    col++;
   }
 }
 
@@ -68,13 +80,22 @@ bool Tokenizer::try_number() {
   while (i < src.size() && (isdigit(src[i]) || src[i] == '.')) {
     if (src[i] == '.') {
       if (has_dot)
-        throw std::runtime_error("Unexpected dot.");
+        throw SourceError(here(), "Unexpected dot.");
       has_dot = true;
     }
     num += src[i++];
-    col++;
   }
-  if (has_dot) {
+  // A type suffix like 255u8 or 1.5f64, checked by the parser.
+  bool float_suffix = false;
+  if (i + 1 < src.size() &&
+      (src[i] == 'i' || src[i] == 'u' || src[i] == 'f') &&
+      isdigit(src[i + 1])) {
+    float_suffix = src[i] == 'f';
+    num += src[i++];
+    while (i < src.size() && isdigit(src[i]))
+      num += src[i++];
+  }
+  if (has_dot || float_suffix) {
     add_token(TokenType::Float, num);
   } else {
     add_token(TokenType::Int, num);
@@ -87,12 +108,11 @@ bool Tokenizer::try_string() {
     return false;
   std::string str;
   i++;
-  col++;
 
   while (i < src.size() && src[i] != '"') {
     if (src[i] == '\\') {
       if (i + 1 >= src.size())
-        throw std::runtime_error("Dangling backslash");
+        throw SourceError(here(), "Dangling backslash.");
       char esc = src[i + 1];
       switch (esc) {
       case '"':
@@ -108,25 +128,22 @@ bool Tokenizer::try_string() {
         str += '\\';
         break;
       default:
-        throw std::runtime_error(
-            "Unrecognized escape sequence: \\" + std::string(1, esc) +
-            " at row " + std::to_string(row) + ", col " + std::to_string(col));
+        throw SourceError(here(), "Unrecognized escape sequence: \\" +
+                                      std::string(1, esc));
       }
       i += 2;
-      col += 2;
     } else {
       str += src[i++];
-      col++;
     }
   }
 
   if (i < src.size() && src[i] == '"') {
     i++;
-    col++;
     add_token(TokenType::String, str);
     return true;
   } else {
-    throw std::runtime_error("Unterminated string");
+    throw SourceError(Position{base + (uint32_t)start},
+                      "Unterminated string.");
   }
 }
 
@@ -135,10 +152,8 @@ bool Tokenizer::try_symbolic() {
     return false;
   std::string sym;
   sym += src[i++];
-  col++;
   while (i < src.size() && is_symbol(src[i])) {
     sym += src[i++];
-    col++;
   }
   auto it = keywords.find(sym);
   if (it != keywords.end()) {
@@ -187,6 +202,9 @@ bool Tokenizer::try_operator() {
   case ',':
     add_token(TokenType::Comma, ",");
     break;
+  case '.':
+    add_token(TokenType::Dot, ".");
+    break;
   case '&':
     add_token(TokenType::Ampersand, "&");
     break;
@@ -194,7 +212,6 @@ bool Tokenizer::try_operator() {
     if (i + 1 < src.size() && src[i + 1] == '=') {
       add_token(TokenType::EqualEqual, "==");
       i++;
-      col++;
     } else {
       add_token(TokenType::Equal, "=");
     }
@@ -203,7 +220,6 @@ bool Tokenizer::try_operator() {
     if (i + 1 < src.size() && src[i + 1] == '=') {
       add_token(TokenType::GreaterEqual, ">=");
       i++;
-      col++;
     } else {
       add_token(TokenType::Greater, ">");
     }
@@ -212,7 +228,6 @@ bool Tokenizer::try_operator() {
     if (i + 1 < src.size() && src[i + 1] == '=') {
       add_token(TokenType::LessEqual, "<=");
       i++;
-      col++;
     } else {
       add_token(TokenType::Less, "<");
     }
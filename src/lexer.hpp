@@ -1,11 +1,36 @@
 #pragma once
+#include <cstdint>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
+// Byte offset into the source file. Rows and columns are only worked out
+// when a position is printed, through a LineTable.
 struct Position {
-  int row;
-  int col;
-  Position(int r, int c) : row(r), col(c) {}
+  uint32_t offset;
+};
+
+// Offsets of the line starts of a source, built on the first lookup.
+struct LineTable {
+  std::string_view src{};
+  std::vector<uint32_t> starts{};
+
+  LineTable() = default;
+  LineTable(std::string_view src) : src(src) {}
+
+  // Offsets of the line starts, building them if needed.
+  const std::vector<uint32_t> &lines();
+
+  // Row and column of `pos`, both starting from 1.
+  std::pair<int, int> locate(Position pos);
+};
+
+struct SourceError : public std::runtime_error {
+  Position pos;
+  SourceError(Position pos, const std::string &what)
+      : std::runtime_error(what), pos(pos) {}
 };
 
 enum class TokenType {
@@ -30,6 +55,7 @@ enum class TokenType {
   Ampersand,
 
   Comma,
+  Dot,
   Equal,
   EqualEqual,
   Greater,
@@ -48,25 +74,36 @@ enum class TokenType {
   KwDo,
   KwEnd,
   KwReturn,
-  KwBreak
+  KwBreak,
+  KwStruct,
+  KwSoa,
+  KwConst,
+  KwSpawn,
+  KwGen,
+  KwYield,
+  KwFor,
+  KwIn,
+  KwMemo
 };
 
 struct LexerToken {
   TokenType type;
-  std::string lexeme;
   Position loc;
+  std::string lexeme;
 
   LexerToken(TokenType t, const std::string &l, Position loc)
-      : type(t), lexeme(l), loc(loc) {}
+      : type(t), loc(loc), lexeme(l) {}
 };
 
 struct Tokenizer {
   std::vector<LexerToken> tokens;
-  int row = 1, col = 1;
-  size_t i = 0;
+  uint32_t base = 0; // Offset of `src` in its file
+  size_t i = 0, start = 0;
   std::string src;
   Tokenizer(std::string &&src) : src(std::move(src)) {}
 
+  Position here() const { return Position{base + (uint32_t)i}; }
+
   void add_token(TokenType type, const std::string &lexeme);
 
   void tokenize();
@@ -1,48 +1,176 @@
 #include "ast.hpp"
+#include "astfile.hpp"
 #include "codegen.hpp"
 #include "lexer.hpp"
+#include "watch.hpp"
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#include <vector>
 
 int main(int argc, char *argv[]) {
-  if (argc < 3) {
+  std::vector<std::string> files{};
+  std::string pgo_generate_dir{}, pgo_use{}, emit_ast{}, from_ast{};
+  bool pgo_generate = false, watch = false;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--profile") {
+      codegen_options.profile = true;
+    } else if (arg == "--pgo-generate") {
+      pgo_generate = true;
+    } else if (arg.starts_with("--pgo-generate=")) {
+      pgo_generate = true;
+      pgo_generate_dir = arg.substr(15);
+    } else if (arg == "--watch") {
+      watch = true;
+    } else if (arg == "--debug") {
+      codegen_options.debug = true;
+    } else if (arg == "--tail-report") {
+      codegen_options.tail_report = true;
+    } else if (arg == "--effects-report") {
+      codegen_options.effects_report = true;
+    } else if (arg == "--shared") {
+      codegen_options.shared = true;
+    } else if (arg.starts_with("--emit-ast=")) {
+      emit_ast = arg.substr(11);
+    } else if (arg.starts_with("--from-ast=")) {
+      from_ast = arg.substr(11);
+    } else if (arg.starts_with("--pgo-use=")) {
+      pgo_use = arg.substr(10);
+    } else if (arg.starts_with("--stack-limit=")) {
+      std::string bytes = arg.substr(14);
+      if (bytes.empty() || bytes.size() > 18 ||
+          bytes.find_first_not_of("0123456789") != std::string::npos) {
+        std::cout << "--stack-limit expects a number of bytes." << std::endl;
+        return 1;
+      }
+      codegen_options.stack_array_limit = std::stoll(bytes);
+    } else if (arg.starts_with("--")) {
+      std::cout << "Unknown option: " << arg << std::endl;
+      return 1;
+    } else {
+      files.push_back(arg);
+    }
+  }
+  // An AST file stands in for the input, and emitting one needs no output.
+  if (!from_ast.empty())
+    files.insert(files.begin(), from_ast);
+  if (files.size() < (emit_ast.empty() ? 2 : 1)) {
     std::cout << "USAGE: " << ((argc > 0) ? argv[0] : "inn")
-              << " <input-file> <output-file>";
+              << " [--watch] [--debug] [--profile] [--tail-report] "
+                 "[--effects-report] [--stack-limit=<bytes>] [--shared] "
+                 "[--pgo-generate[=<dir>] | --pgo-use=<dir>] "
+                 "[--emit-ast=<file>] <input-file> <output-file>\n"
+              << "       " << ((argc > 0) ? argv[0] : "inn")
+              << " [options] --from-ast=<file> <output-file>";
     return 1;
   }
-  std::ifstream fstr(argv[1]);
-  std::ostringstream ss;
-  ss << fstr.rdbuf();
-  std::string code = ss.str();
-  fstr.close();
-
-  Tokenizer tknizer(std::move(code));
-  tknizer.tokenize();
-
-  // for (const auto &t : tknizer.tokens) {
-  //   std::cout << static_cast<int>(t.type) << " \"" << t.lexeme << "\" at ("
-  //             << t.loc.row << ", " << t.loc.col << ")" << std::endl;
-  // }
-
-  // std::cout << std::endl;
-  // std::cout << "------" << std::endl;
-
-  ASTBuilder blder(std::move(tknizer.tokens));
-  blder.parse();
-  std::ofstream out(std::string(argv[2]) + ".c");
-  out << begin_file();
-  for (auto &para : blder.roots) {
-    std::string gen = generate_one(para);
-    // std::cout << gen;
-    out << gen;
+  if (watch && !(emit_ast.empty() && from_ast.empty())) {
+    std::cout << "--watch reads the source, not AST files." << std::endl;
+    return 1;
+  }
+  if (pgo_generate && !pgo_use.empty()) {
+    std::cout << "--pgo-generate and --pgo-use are exclusive." << std::endl;
+    return 1;
   }
+  if (pgo_generate && pgo_generate_dir.empty())
+    pgo_generate_dir = files[1] + ".pgo";
+  if (!pgo_use.empty() && !std::filesystem::is_directory(pgo_use)) {
+    std::cerr << "can't read profile " << pgo_use << ": not a directory"
+              << std::endl;
+    return 1;
+  }
+  if (pgo_generate) {
+    // Start every training session from a clean profile.
+    std::filesystem::remove_all(pgo_generate_dir);
+    std::filesystem::create_directories(pgo_generate_dir);
+  }
+  // The command depends on the runtime modules the program used.
+  auto compile_command = [&]() {
+    std::string comp = "cc " + files[1] + ".c" + " -o " + files[1];
+    // Only the funcs in the header are visible outside a library.
+    if (codegen_options.shared)
+      comp += " -shared -fPIC -fvisibility=hidden";
+    // 32-byte vectors work without AVX, GCC just notes the ABI difference.
+    if (std::find(runtime_modules.begin(), runtime_modules.end(), "simd") !=
+        runtime_modules.end())
+      comp += " -Wno-psabi";
+    if (codegen_options.debug)
+      comp += " -g";
+    if (std::find(runtime_modules.begin(), runtime_modules.end(), "task") !=
+        runtime_modules.end())
+      comp += " -pthread";
+    // Both builds compile the same C with the same passes, so the profile
+    // matches function for function. INN_PGO drops the runtime's per-function
+    // optimize pragmas, which GCC instruments differently from the use build.
+    // With the profile the C compiler weighs every if and while by its
+    // measured counts.
+    if (pgo_generate)
+      comp += " -O2 -DINN_PGO -fprofile-generate=" + pgo_generate_dir;
+    else if (!pgo_use.empty())
+      comp += " -O2 -DINN_PGO -fprofile-use=" + pgo_use +
+              " -fprofile-partial-training -Wno-missing-profile";
+    return comp;
+  };
+  codegen_options.source_name = files[0];
+  if (watch)
+    return Watcher{files[0], files[1], compile_command}.run();
+  std::string code{};
+  std::vector<Paragraph> roots{};
+  if (!from_ast.empty()) {
+    try {
+      ASTFile loaded = load_ast(from_ast);
+      codegen_options.source_name = loaded.source_name;
+      source_lines.starts = std::move(loaded.line_starts);
+      roots = std::move(loaded.roots);
+    } catch (const std::exception &err) {
+      std::cerr << err.what() << std::endl;
+      return 1;
+    }
+  } else {
+    std::ifstream fstr(files[0]);
+    std::ostringstream ss;
+    ss << fstr.rdbuf();
+    code = ss.str();
+    fstr.close();
+    source_lines = LineTable(code);
+    try {
+      roots = parse_source(std::string(code));
+    } catch (const SourceError &err) {
+      std::cerr << source_location(err.pos) << ": " << err.what() << std::endl;
+      return 1;
+    }
+  }
+  if (!emit_ast.empty()) {
+    try {
+      save_ast(emit_ast, roots, codegen_options.source_name, source_lines);
+    } catch (const std::exception &err) {
+      std::cerr << err.what() << std::endl;
+      return 1;
+    }
+    if (files.size() < 2)
+      return 0;
+  }
+  std::string program{}, header{};
+  try {
+    program = generate_program(roots);
+    if (codegen_options.shared)
+      header = generate_header(roots);
+  } catch (const SourceError &err) {
+    std::cerr << source_location(err.pos) << ": " << err.what() << std::endl;
+    return 1;
+  } catch (const std::exception &err) {
+    std::cerr << codegen_options.source_name << ": " << err.what()
+              << std::endl;
+    return 1;
+  }
+  std::ofstream out(files[1] + ".c");
+  out << program;
   out.flush();
   out.close();
+  if (codegen_options.shared)
+    std::ofstream(header_path(files[1])) << header;
 
-  std::string comp =
-      "cc " + std::string(argv[2]) + ".c" + " -o " + std::string(argv[2]);
-  system(comp.c_str());
-
-  return 0;
+  return system(compile_command().c_str()) == 0 ? 0 : 1;
 }
@@ -0,0 +1,1455 @@
+#pragma once
+
+#include <stdexcept>
+#include <string>
+
+// C sources emitted alongside the generated program. Kept as raw strings so
+// the output file stays self-contained.
+
+std::string profile_runtime() {
+  return R"(
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define INN_PROF_UNIT "cycles"
+static inline unsigned long long inn_prof_now(void) { return __rdtsc(); }
+#else
+#include <time.h>
+#define INN_PROF_UNIT "ns"
+static inline unsigned long long inn_prof_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+#endif
+
+static _Thread_local unsigned long long inn_prof_child;
+
+// Each thread counts into a block of its own, so tasks don't race on shared
+// counters. Blocks stay on the list after their thread ends and the report
+// sums them all. A thread still running at exit is read as it stands, hence
+// the relaxed atomics, which cost nothing more than plain loads and stores.
+typedef struct inn_prof_block {
+  struct inn_prof_block *next;
+  unsigned long long calls[INN_PROF_NFUNCS + 1], incl[INN_PROF_NFUNCS + 1],
+      excl[INN_PROF_NFUNCS + 1], trips[INN_PROF_NLOOPS + 1];
+} inn_prof_block;
+
+static inn_prof_block *inn_prof_blocks;
+static _Thread_local inn_prof_block *inn_prof_self;
+
+#define INN_PROF_ADD(c, n)                                                     \
+  __atomic_store_n(&(c), __atomic_load_n(&(c), __ATOMIC_RELAXED) + (n),        \
+                   __ATOMIC_RELAXED)
+#define INN_PROF_GET(c) __atomic_load_n(&(c), __ATOMIC_RELAXED)
+
+static inn_prof_block *inn_prof_new_block(void) {
+  inn_prof_block *b = calloc(1, sizeof(*b));
+  if (!b) {
+    fprintf(stderr, "inn: out of memory\n");
+    abort();
+  }
+  b->next = __atomic_load_n(&inn_prof_blocks, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&inn_prof_blocks, &b->next, b, 1,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+  return inn_prof_self = b;
+}
+
+static inline inn_prof_block *inn_prof_block_of_thread(void) {
+  return inn_prof_self ? inn_prof_self : inn_prof_new_block();
+}
+
+static inline void inn_prof_trip(int loop) {
+  INN_PROF_ADD(inn_prof_block_of_thread()->trips[loop], 1);
+}
+
+static inline void inn_prof_leave(int func, unsigned long long t0,
+                                  unsigned long long outer) {
+  unsigned long long dt = inn_prof_now() - t0;
+  inn_prof_block *b = inn_prof_block_of_thread();
+  INN_PROF_ADD(b->calls[func], 1);
+  INN_PROF_ADD(b->incl[func], dt);
+  INN_PROF_ADD(b->excl[func], dt - inn_prof_child);
+  inn_prof_child = outer + dt;
+}
+
+static int inn_prof_cmp_func(const void *a, const void *b) {
+  const inn_prof_func *l = *(const inn_prof_func **)a;
+  const inn_prof_func *r = *(const inn_prof_func **)b;
+  return (l->excl < r->excl) - (l->excl > r->excl);
+}
+
+static int inn_prof_cmp_loop(const void *a, const void *b) {
+  const inn_prof_loop *l = *(const inn_prof_loop **)a;
+  const inn_prof_loop *r = *(const inn_prof_loop **)b;
+  return (l->trips < r->trips) - (l->trips > r->trips);
+}
+
+__attribute__((destructor)) static void inn_prof_report(void) {
+  inn_prof_func *funcs[INN_PROF_NFUNCS + 1];
+  inn_prof_loop *loops[INN_PROF_NLOOPS + 1];
+  unsigned long long total = 0;
+  for (inn_prof_block *b = __atomic_load_n(&inn_prof_blocks, __ATOMIC_ACQUIRE);
+       b; b = b->next) {
+    for (int i = 0; i < INN_PROF_NFUNCS; ++i) {
+      inn_prof_funcs[i].calls += INN_PROF_GET(b->calls[i]);
+      inn_prof_funcs[i].incl += INN_PROF_GET(b->incl[i]);
+      inn_prof_funcs[i].excl += INN_PROF_GET(b->excl[i]);
+    }
+    for (int i = 0; i < INN_PROF_NLOOPS; ++i)
+      inn_prof_loops[i].trips += INN_PROF_GET(b->trips[i]);
+  }
+  for (int i = 0; i < INN_PROF_NFUNCS; ++i) {
+    funcs[i] = &inn_prof_funcs[i];
+    total += inn_prof_funcs[i].excl;
+  }
+  for (int i = 0; i < INN_PROF_NLOOPS; ++i)
+    loops[i] = &inn_prof_loops[i];
+  qsort(funcs, INN_PROF_NFUNCS, sizeof(*funcs), inn_prof_cmp_func);
+  qsort(loops, INN_PROF_NLOOPS, sizeof(*loops), inn_prof_cmp_loop);
+
+  fprintf(stderr, "\n== inn profile: functions by exclusive " INN_PROF_UNIT
+                  " ==\n");
+  fprintf(stderr, "%7s %16s %16s %12s  %s\n", "excl%", "exclusive",
+          "inclusive", "calls", "function");
+  for (int i = 0; i < INN_PROF_NFUNCS; ++i) {
+    if (funcs[i]->calls == 0)
+      continue;
+    fprintf(stderr, "%6.2f%% %16llu %16llu %12llu  %s (%s)\n",
+            total ? 100.0 * funcs[i]->excl / total : 0.0, funcs[i]->excl,
+            funcs[i]->incl, funcs[i]->calls, funcs[i]->name, funcs[i]->loc);
+  }
+  if (INN_PROF_NLOOPS == 0)
+    return;
+  fprintf(stderr, "== inn profile: loops by trip count ==\n");
+  fprintf(stderr, "%16s  %s\n", "trips", "loop");
+  for (int i = 0; i < INN_PROF_NLOOPS; ++i) {
+    if (loops[i]->trips == 0)
+      continue;
+    fprintf(stderr, "%16llu  %s\n", loops[i]->trips, loops[i]->loc);
+  }
+}
+)";
+}
+
+std::string region_runtime() {
+  return R"(
+#include <stddef.h>
+#include <stdint.h>
+
+#define INN_REGION_CHUNK (1 << 20)
+
+typedef struct inn_region_chunk {
+  struct inn_region_chunk *next;
+  size_t size;
+  size_t used;
+  max_align_t data[];
+} inn_region_chunk;
+
+// Chunks past `cur` are kept around after a reset and reused in order.
+typedef struct {
+  inn_region_chunk *first;
+  inn_region_chunk *cur;
+  size_t chunk_size;
+} inn_region;
+
+static void *inn_region_oom(void) {
+  fprintf(stderr, "inn: region out of memory\n");
+  abort();
+}
+
+static inn_region_chunk *inn_region_chunk_new(size_t size) {
+  inn_region_chunk *c = malloc(sizeof(inn_region_chunk) + size);
+  if (!c)
+    return inn_region_oom();
+  c->next = NULL;
+  c->size = size;
+  c->used = 0;
+  return c;
+}
+
+static inn_region *inn_region_create(long long chunk_size) {
+  inn_region *r = malloc(sizeof(*r));
+  if (!r)
+    return inn_region_oom();
+  r->chunk_size = chunk_size > 0 ? (size_t)chunk_size : INN_REGION_CHUNK;
+  r->first = r->cur = inn_region_chunk_new(r->chunk_size);
+  return r;
+}
+
+static inline long long inn_region_align(long long want, long long natural) {
+  return want > natural ? want : natural;
+}
+
+static inline void *inn_region_bump(inn_region_chunk *c, size_t size,
+                                    size_t align) {
+  uintptr_t base = (uintptr_t)c->data;
+  uintptr_t p = (base + c->used + (align - 1)) & ~(uintptr_t)(align - 1);
+  if (p + size > base + c->size)
+    return NULL;
+  c->used = p + size - base;
+  return (void *)p;
+}
+
+static void *inn_region_alloc_slow(inn_region *r, size_t size, size_t align) {
+  inn_region_chunk *c = r->cur;
+  while (c->next) {
+    c = c->next;
+    c->used = 0;
+    void *p = inn_region_bump(c, size, align);
+    if (p) {
+      r->cur = c;
+      return p;
+    }
+  }
+  size_t want = size + align > r->chunk_size ? size + align : r->chunk_size;
+  c->next = inn_region_chunk_new(want);
+  r->cur = c->next;
+  return inn_region_bump(r->cur, size, align);
+}
+
+static inline void *inn_region_alloc(inn_region *r, long long size,
+                                     long long align) {
+  if (size < 0 || align <= 0 || (align & (align - 1)) != 0) {
+    fprintf(stderr, "inn: bad region allocation of %lld bytes aligned to %lld\n",
+            size, align);
+    abort();
+  }
+  void *p = inn_region_bump(r->cur, size, align);
+  return p ? p : inn_region_alloc_slow(r, size, align);
+}
+
+static inline void inn_region_reset(inn_region *r) {
+  r->cur = r->first;
+  r->first->used = 0;
+}
+
+static void inn_region_destroy(inn_region *r) {
+  inn_region_chunk *c = r->first;
+  while (c) {
+    inn_region_chunk *next = c->next;
+    free(c);
+    c = next;
+  }
+  free(r);
+}
+)";
+}
+
+std::string string_runtime() {
+  return R"(
+#include <string.h>
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "inn strings assume a little-endian target"
+#endif
+
+// Strings up to 15 bytes are stored inline with their length in the last
+// byte, tagged by its top bit. Longer ones point at their bytes and keep the
+// length in `meta`, which is never tagged. Either way they fit in two
+// registers.
+typedef union {
+  struct {
+    const char *ptr;
+    unsigned long long meta;
+  } p;
+  char small[16];
+} inn_str;
+
+#define INN_STR_INLINE 0x80
+#define INN_STR_TERM (1ull << 62) // Pointed to bytes are NUL-terminated
+#define INN_STR_LEN ((1ull << 56) - 1)
+#define INN_STR_DATA(s) (inn_str_inline(s) ? (s).small : (s).p.ptr)
+
+static inline int inn_str_inline(inn_str s) {
+  return (unsigned char)s.small[15] & INN_STR_INLINE;
+}
+
+static inline long long inn_str_len(inn_str s) {
+  if (inn_str_inline(s))
+    return s.small[15] & 0x7f;
+  return (long long)(s.p.meta & INN_STR_LEN);
+}
+
+// What Inn code sees, `int` is a C int.
+static inline int inn_len(inn_str s) { return (int)inn_str_len(s); }
+
+static inline inn_str inn_str_from(const char *data, long long len,
+                                   int term) {
+  inn_str s;
+  if (len < 16) {
+    memset(&s, 0, sizeof(s));
+    memcpy(s.small, data, len);
+    s.small[15] = (char)(INN_STR_INLINE | len);
+    return s;
+  }
+  s.p.ptr = data;
+  s.p.meta = (unsigned long long)len | (term ? INN_STR_TERM : 0);
+  return s;
+}
+
+static inline int inn_str_at(inn_str s, long long i) {
+  if (i < 0 || i >= inn_str_len(s)) {
+    fprintf(stderr, "inn: string index %lld out of range\n", i);
+    abort();
+  }
+  return (unsigned char)INN_STR_DATA(s)[i];
+}
+
+// Long strings are sliced in place, short ones are copied inline.
+static inline inn_str inn_str_slice(inn_str s, long long from, long long to) {
+  long long len = inn_str_len(s);
+  if (from < 0 || to < from || to > len) {
+    fprintf(stderr, "inn: slice [%lld, %lld) out of range for length %lld\n",
+            from, to, len);
+    abort();
+  }
+  int term = !inn_str_inline(s) && (s.p.meta & INN_STR_TERM) && to == len;
+  return inn_str_from(INN_STR_DATA(s) + from, to - from, term);
+}
+
+static inline int inn_str_eq(inn_str a, inn_str b) {
+  long long len = inn_str_len(a);
+  return len == inn_str_len(b) &&
+         memcmp(INN_STR_DATA(a), INN_STR_DATA(b), len) == 0;
+}
+
+// For map keys. Mixes the bytes eight at a time.
+static inline unsigned long long inn_str_hash(inn_str s) {
+  const char *p = INN_STR_DATA(s);
+  long long n = inn_str_len(s);
+  unsigned long long h = 0x9e3779b97f4a7c15ull ^ (unsigned long long)n, w;
+  for (; n >= 8; p += 8, n -= 8) {
+    memcpy(&w, p, 8);
+    h = (h ^ w) * 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 29;
+  }
+  w = 0;
+  memcpy(&w, p, n);
+  h = (h ^ w) * 0x94d049bb133111ebull;
+  return h ^ (h >> 31);
+}
+
+static inn_str inn_str_concat_n(int n, const inn_str *parts) {
+  long long total = 0;
+  for (int i = 0; i < n; ++i)
+    total += inn_str_len(parts[i]);
+  char tmp[16];
+  char *buf = total < 16 ? tmp : malloc(total + 1);
+  if (!buf) {
+    fprintf(stderr, "inn: out of memory\n");
+    abort();
+  }
+  long long at = 0;
+  for (int i = 0; i < n; ++i) {
+    inn_str part = parts[i];
+    long long len = inn_str_len(part);
+    memcpy(buf + at, INN_STR_DATA(part), len);
+    at += len;
+  }
+  buf[total] = 0;
+  return inn_str_from(buf, total, 1);
+}
+
+static inline inn_str inn_str_concat(inn_str a, inn_str b) {
+  inn_str parts[2] = {a, b};
+  return inn_str_concat_n(2, parts);
+}
+
+// Buffer a string variable's concatenations are built in, for variables whose
+// value nothing else can hold on to. Freed with the variable.
+typedef struct {
+  char *data;
+  long long cap;
+} inn_str_owner;
+
+static inline void inn_str_owner_release(inn_str_owner *o) { free(o->data); }
+
+static inline int inn_str_in(inn_str s, const inn_str_owner *o) {
+  uintptr_t p = (uintptr_t)s.p.ptr, base = (uintptr_t)o->data;
+  return !inn_str_inline(s) && p >= base && p < base + o->cap;
+}
+
+// inn_str_concat_n into the owner's buffer. A first part already at its start
+// stays in place, so s = s + x grows the buffer geometrically instead of
+// copying s every time. Other parts pointing into the buffer are copied into
+// a new one, which then replaces it.
+static inn_str inn_str_concat_owned(inn_str_owner *o, int n,
+                                    const inn_str *parts) {
+  long long total = 0;
+  for (int i = 0; i < n; ++i)
+    total += inn_str_len(parts[i]);
+  if (total < 16)
+    return inn_str_concat_n(n, parts);
+  int from = !inn_str_inline(parts[0]) && parts[0].p.ptr == o->data;
+  long long at = from ? inn_str_len(parts[0]) : 0;
+  int alias = 0;
+  for (int i = from; i < n; ++i)
+    alias |= inn_str_in(parts[i], o);
+  char *buf = o->data;
+  long long cap = o->cap;
+  if (alias || cap < total + 1) {
+    cap = cap * 2 > total + 1 ? cap * 2 : total + 1;
+    buf = alias ? malloc(cap) : realloc(o->data, cap);
+    if (!buf) {
+      fprintf(stderr, "inn: out of memory\n");
+      abort();
+    }
+    if (alias)
+      memcpy(buf, o->data, at);
+  }
+  for (int i = from; i < n; ++i) {
+    long long len = inn_str_len(parts[i]);
+    memcpy(buf + at, INN_STR_DATA(parts[i]), len);
+    at += len;
+  }
+  buf[total] = 0;
+  if (alias)
+    free(o->data);
+  o->data = buf;
+  o->cap = cap;
+  return inn_str_from(buf, total, 1);
+}
+
+// Each cstr call in the program copies into a buffer of its own, so all the
+// copies made while evaluating one statement stay apart.
+typedef struct {
+  char *data;
+  long long cap;
+} inn_cstr_buf;
+
+// The returned pointer stays valid until `buf` is used again, unless the
+// string already was NUL-terminated.
+static const char *inn_cstr(inn_cstr_buf *buf, inn_str s) {
+  if (!inn_str_inline(s) && (s.p.meta & INN_STR_TERM))
+    return s.p.ptr;
+  long long len = inn_str_len(s);
+  if (buf->cap < len + 1) {
+    buf->data = realloc(buf->data, len + 1);
+    if (!buf->data) {
+      fprintf(stderr, "inn: out of memory\n");
+      abort();
+    }
+    buf->cap = len + 1;
+  }
+  memcpy(buf->data, INN_STR_DATA(s), len);
+  buf->data[len] = 0;
+  return buf->data;
+}
+
+static inn_str *inn_str_argv(int argc, char **argv) {
+  inn_str *res = malloc(sizeof(inn_str) * (argc + 1));
+  for (int i = 0; i < argc; ++i)
+    res[i] = inn_str_from(argv[i], strlen(argv[i]), 1);
+  res[argc] = inn_str_from("", 0, 1);
+  return res;
+}
+
+typedef struct {
+  char *data;
+  long long len;
+  long long cap;
+} inn_builder;
+
+static inline void inn_builder_reserve(inn_builder *b, long long extra) {
+  if (b->len + extra + 1 <= b->cap)
+    return;
+  long long cap = b->cap ? b->cap * 2 : 64;
+  while (cap < b->len + extra + 1)
+    cap *= 2;
+  b->data = realloc(b->data, cap);
+  if (!b->data) {
+    fprintf(stderr, "inn: out of memory\n");
+    abort();
+  }
+  b->cap = cap;
+}
+
+static inline void inn_builder_append(inn_builder *b, inn_str s) {
+  long long len = inn_str_len(s);
+  inn_builder_reserve(b, len);
+  memcpy(b->data + b->len, INN_STR_DATA(s), len);
+  b->len += len;
+}
+
+// Short results are copied out and the buffer kept for reuse, longer ones
+// take the buffer over and leave the builder empty.
+static inn_str inn_builder_finish(inn_builder *b) {
+  inn_builder_reserve(b, 0);
+  b->data[b->len] = 0;
+  inn_str s = inn_str_from(b->data, b->len, 1);
+  if (b->len < 16) {
+    b->len = 0;
+  } else {
+    b->data = NULL;
+    b->len = b->cap = 0;
+  }
+  return s;
+}
+)";
+}
+
+std::string simd_runtime() {
+  return R"(
+#include <string.h>
+
+typedef float inn_vec4f __attribute__((vector_size(16)));
+typedef float inn_vec8f __attribute__((vector_size(32)));
+typedef int inn_vec4i __attribute__((vector_size(16)));
+typedef int inn_vec8i __attribute__((vector_size(32)));
+
+// Loads and stores go through memcpy, so arrays needn't be aligned.
+#define INN_VEC_OPS(V, E, N)                                                   \
+  static inline V V##_load(const E *p, int i) {                                \
+    V v;                                                                       \
+    memcpy(&v, p + i, sizeof(v));                                              \
+    return v;                                                                  \
+  }                                                                            \
+  static inline void V##_store(E *p, int i, V v) {                             \
+    memcpy(p + i, &v, sizeof(v));                                              \
+  }                                                                            \
+  static inline V V##_splat(E x) { return (V){0} + x; }                        \
+  static inline E V##_sum(V v) {                                               \
+    E s = 0;                                                                   \
+    for (int k = 0; k < N; ++k)                                                \
+      s += v[k];                                                               \
+    return s;                                                                  \
+  }
+
+INN_VEC_OPS(inn_vec4f, float, 4)
+INN_VEC_OPS(inn_vec8f, float, 8)
+INN_VEC_OPS(inn_vec4i, int, 4)
+INN_VEC_OPS(inn_vec8i, int, 8)
+)";
+}
+
+// Needs the simd module for its vector types.
+std::string reduce_runtime() {
+  return R"(
+// Library code, so it's optimized even when the program isn't.
+#ifndef INN_PGO
+#pragma GCC push_options
+#pragma GCC optimize("O3")
+#endif
+
+#define INN_LOAD(V, p)                                                         \
+  ({                                                                           \
+    V v_;                                                                      \
+    memcpy(&v_, (p), sizeof(v_));                                              \
+    v_;                                                                        \
+  })
+
+// Reductions keep several vector accumulators, so consecutive adds don't
+// wait on each other, and fold them together at the end.
+#define INN_REDUCE_OPS(S, E, V, V4)                                            \
+  static E inn_sum_##S(const E *p, long long n) {                              \
+    V a0 = {0}, a1 = {0}, a2 = {0}, a3 = {0};                                  \
+    long long i = 0;                                                           \
+    for (; i + 32 <= n; i += 32) {                                             \
+      a0 += INN_LOAD(V, p + i);                                                \
+      a1 += INN_LOAD(V, p + i + 8);                                            \
+      a2 += INN_LOAD(V, p + i + 16);                                           \
+      a3 += INN_LOAD(V, p + i + 24);                                           \
+    }                                                                          \
+    for (; i + 8 <= n; i += 8)                                                 \
+      a0 += INN_LOAD(V, p + i);                                                \
+    a0 = (a0 + a1) + (a2 + a3);                                                \
+    E s = 0;                                                                   \
+    for (int k = 0; k < 8; ++k)                                                \
+      s += a0[k];                                                              \
+    for (; i < n; ++i)                                                         \
+      s += p[i];                                                               \
+    return s;                                                                  \
+  }                                                                            \
+  static E inn_dot_##S(const E *p, const E *q, long long n) {                  \
+    V a0 = {0}, a1 = {0}, a2 = {0}, a3 = {0};                                  \
+    long long i = 0;                                                           \
+    for (; i + 32 <= n; i += 32) {                                             \
+      a0 += INN_LOAD(V, p + i) * INN_LOAD(V, q + i);                           \
+      a1 += INN_LOAD(V, p + i + 8) * INN_LOAD(V, q + i + 8);                   \
+      a2 += INN_LOAD(V, p + i + 16) * INN_LOAD(V, q + i + 16);                 \
+      a3 += INN_LOAD(V, p + i + 24) * INN_LOAD(V, q + i + 24);                 \
+    }                                                                          \
+    for (; i + 8 <= n; i += 8)                                                 \
+      a0 += INN_LOAD(V, p + i) * INN_LOAD(V, q + i);                           \
+    a0 = (a0 + a1) + (a2 + a3);                                                \
+    E s = 0;                                                                   \
+    for (int k = 0; k < 8; ++k)                                                \
+      s += a0[k];                                                              \
+    for (; i < n; ++i)                                                         \
+      s += p[i] * q[i];                                                        \
+    return s;                                                                  \
+  }                                                                            \
+  INN_EXTREMUM(min, S, E, V4, <)                                               \
+  INN_EXTREMUM(max, S, E, V4, >)                                               \
+  /* Inclusive scan in place, four lanes at a time with shifted adds. */       \
+  static void inn_prefix_sum_##S(E *p, long long n) {                          \
+    E carry = 0;                                                               \
+    long long i = 0;                                                           \
+    for (; i + 4 <= n; i += 4) {                                               \
+      V4 x = INN_LOAD(V4, p + i);                                              \
+      x += __builtin_shuffle(x, (V4){0}, (inn_vec4i){4, 0, 1, 2});             \
+      x += __builtin_shuffle(x, (V4){0}, (inn_vec4i){4, 5, 0, 1});             \
+      x += carry;                                                              \
+      memcpy(p + i, &x, sizeof(x));                                            \
+      carry = x[3];                                                            \
+    }                                                                          \
+    for (; i < n; ++i)                                                         \
+      p[i] = carry += p[i];                                                    \
+  }
+
+// Lanes where the comparison holds are taken from x. Uses native width
+// vectors, wider compares are split up lane by lane. The minimum or maximum
+// of an empty array is 0.
+#define INN_EXTREMUM(NAME, S, E, V, CMP)                                       \
+  static E inn_##NAME##_##S(const E *p, long long n) {                         \
+    if (n <= 0)                                                                \
+      return 0;                                                                \
+    E m = p[0];                                                                \
+    long long i = 0;                                                           \
+    if (n >= 16) {                                                             \
+      V a[4];                                                                  \
+      for (int j = 0; j < 4; ++j)                                              \
+        a[j] = INN_LOAD(V, p + 4 * j);                                         \
+      for (i = 16; i + 16 <= n; i += 16)                                       \
+        for (int j = 0; j < 4; ++j) {                                          \
+          V x = INN_LOAD(V, p + i + 4 * j);                                    \
+          inn_vec4i mask = x CMP a[j];                                         \
+          a[j] = (V)(((inn_vec4i)x & mask) | ((inn_vec4i)a[j] & ~mask));       \
+        }                                                                      \
+      for (int j = 0; j < 4; ++j)                                              \
+        for (int k = 0; k < 4; ++k)                                            \
+          m = a[j][k] CMP m ? a[j][k] : m;                                     \
+    }                                                                          \
+    for (; i < n; ++i)                                                         \
+      m = p[i] CMP m ? p[i] : m;                                               \
+    return m;                                                                  \
+  }
+
+INN_REDUCE_OPS(f, float, inn_vec8f, inn_vec4f)
+INN_REDUCE_OPS(i, int, inn_vec8i, inn_vec4i)
+
+#ifndef INN_PGO
+#pragma GCC pop_options
+#endif
+)";
+}
+
+std::string task_runtime() {
+  return R"(
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+
+#define INN_TASK_DEQUE (1 << 12)
+#define INN_TASK_MAX_WORKERS 64
+
+// Spawned calls are a task header followed by the result and arguments.
+typedef struct inn_task {
+  void (*run)(struct inn_task *);
+  void *result;
+  atomic_int done;
+} inn_task;
+
+// Chase-Lev deque. The owning worker pushes and pops at the bottom, so it
+// runs its newest task first, and idle workers steal the oldest from the top.
+typedef struct {
+  _Alignas(64) atomic_long top;
+  _Alignas(64) atomic_long bottom;
+  _Alignas(64) inn_task *_Atomic tasks[INN_TASK_DEQUE];
+} inn_task_deque;
+
+static inn_task_deque inn_task_deques[INN_TASK_MAX_WORKERS];
+static int inn_task_workers = 1;
+static _Thread_local int inn_task_self;
+static _Thread_local unsigned inn_task_seed = 1;
+static pthread_once_t inn_task_once = PTHREAD_ONCE_INIT;
+
+static int inn_task_push(inn_task_deque *d, inn_task *t) {
+  long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+  long top = atomic_load_explicit(&d->top, memory_order_acquire);
+  if (b - top >= INN_TASK_DEQUE)
+    return 0;
+  atomic_store_explicit(&d->tasks[b & (INN_TASK_DEQUE - 1)], t,
+                        memory_order_relaxed);
+  atomic_store_explicit(&d->bottom, b + 1, memory_order_release);
+  return 1;
+}
+
+static inn_task *inn_task_pop(inn_task_deque *d) {
+  long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+  atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  long top = atomic_load_explicit(&d->top, memory_order_relaxed);
+  if (top > b) {
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    return NULL;
+  }
+  inn_task *t = atomic_load_explicit(&d->tasks[b & (INN_TASK_DEQUE - 1)],
+                                     memory_order_relaxed);
+  if (top == b) {
+    // Last task, race thieves for it.
+    if (!atomic_compare_exchange_strong_explicit(
+            &d->top, &top, top + 1, memory_order_seq_cst,
+            memory_order_relaxed))
+      t = NULL;
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+  }
+  return t;
+}
+
+static inn_task *inn_task_steal_from(inn_task_deque *d) {
+  long top = atomic_load_explicit(&d->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  long b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+  if (top >= b)
+    return NULL;
+  inn_task *t = atomic_load_explicit(&d->tasks[top & (INN_TASK_DEQUE - 1)],
+                                     memory_order_relaxed);
+  if (!atomic_compare_exchange_strong_explicit(
+          &d->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed))
+    return NULL;
+  return t;
+}
+
+// Tries every other worker once, starting from a random one.
+static inn_task *inn_task_steal(void) {
+  inn_task_seed ^= inn_task_seed << 13;
+  inn_task_seed ^= inn_task_seed >> 17;
+  inn_task_seed ^= inn_task_seed << 5;
+  int start = inn_task_seed % inn_task_workers;
+  for (int i = 0; i < inn_task_workers; ++i) {
+    int victim = (start + i) % inn_task_workers;
+    if (victim == inn_task_self)
+      continue;
+    inn_task *t = inn_task_steal_from(&inn_task_deques[victim]);
+    if (t)
+      return t;
+  }
+  return NULL;
+}
+
+static void inn_task_run(inn_task *t) {
+  t->run(t);
+  atomic_store_explicit(&t->done, 1, memory_order_release);
+}
+
+// Idle workers spin briefly, then yield, then sleep so that a program which
+// has stopped spawning doesn't keep every core busy.
+static void inn_task_idle(unsigned *misses) {
+  if (++*misses < 64)
+    return;
+  if (*misses < 1024) {
+    sched_yield();
+    return;
+  }
+  struct timespec ts = {0, 50000};
+  nanosleep(&ts, NULL);
+}
+
+static void *inn_task_worker(void *arg) {
+  inn_task_self = (int)(long)arg;
+  inn_task_seed = 2654435761u * (inn_task_self + 1);
+  unsigned misses = 0;
+  for (;;) {
+    inn_task *t = inn_task_pop(&inn_task_deques[inn_task_self]);
+    if (!t)
+      t = inn_task_steal();
+    if (t) {
+      inn_task_run(t);
+      misses = 0;
+    } else {
+      inn_task_idle(&misses);
+    }
+  }
+  return NULL;
+}
+
+// One worker per core, the main thread being worker 0. INN_WORKERS overrides
+// the count.
+static void inn_task_start(void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  const char *env = getenv("INN_WORKERS");
+  if (env && atoi(env) > 0)
+    n = atoi(env);
+  if (n < 1)
+    n = 1;
+  if (n > INN_TASK_MAX_WORKERS)
+    n = INN_TASK_MAX_WORKERS;
+  inn_task_workers = (int)n;
+  for (long i = 1; i < n; ++i) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, inn_task_worker, (void *)i) != 0) {
+      inn_task_workers = (int)i;
+      break;
+    }
+    pthread_detach(thread);
+  }
+}
+
+static void *inn_task_alloc(size_t size) {
+  void *t = malloc(size);
+  if (!t) {
+    fprintf(stderr, "inn: task out of memory\n");
+    abort();
+  }
+  return t;
+}
+
+// A full deque runs the task straight away instead.
+static void inn_task_spawn(inn_task *t, void (*run)(inn_task *)) {
+  pthread_once(&inn_task_once, inn_task_start);
+  t->run = run;
+  atomic_init(&t->done, 0);
+  if (!inn_task_push(&inn_task_deques[inn_task_self], t))
+    inn_task_run(t);
+}
+
+// Waiting workers run other tasks, their own first, until `t` is done.
+static void inn_task_join(inn_task *t) {
+  unsigned misses = 0;
+  while (!atomic_load_explicit(&t->done, memory_order_acquire)) {
+    inn_task *other = inn_task_pop(&inn_task_deques[inn_task_self]);
+    if (!other)
+      other = inn_task_steal();
+    if (other) {
+      inn_task_run(other);
+      misses = 0;
+    } else if (++misses > 64) {
+      sched_yield();
+    }
+  }
+}
+)";
+}
+
+std::string print_runtime() {
+  return R"(
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+
+// Runs for every print, so it's optimized even in -O0 builds.
+#ifndef INN_PGO
+#pragma GCC push_options
+#pragma GCC optimize("O2")
+#endif
+
+#define INN_OUT_SIZE (1 << 16)
+
+// Output is collected in a buffer per thread and handed to stdout in large
+// writes. Buffers are kept in a list so that all of them are flushed at exit.
+typedef struct inn_out_buf {
+  struct inn_out_buf *next;
+  size_t len;
+  char data[INN_OUT_SIZE];
+} inn_out_buf;
+
+static inn_out_buf *_Atomic inn_out_all;
+static _Thread_local inn_out_buf *inn_out;
+static atomic_flag inn_out_lock = ATOMIC_FLAG_INIT;
+static int inn_out_tty; // Terminals get each print as soon as it's done
+
+static void inn_out_write(const char *p, size_t n) {
+  while (atomic_flag_test_and_set_explicit(&inn_out_lock, memory_order_acquire))
+    ;
+  fwrite(p, 1, n, stdout);
+  atomic_flag_clear_explicit(&inn_out_lock, memory_order_release);
+}
+
+static void inn_out_flush_buf(inn_out_buf *b) {
+  inn_out_write(b->data, b->len);
+  b->len = 0;
+}
+
+static void inn_out_exit(void) {
+  for (inn_out_buf *b = atomic_load(&inn_out_all); b; b = b->next)
+    if (b->len)
+      inn_out_flush_buf(b);
+}
+
+static inn_out_buf *inn_out_new(void) {
+  inn_out_buf *b = malloc(sizeof(*b));
+  if (!b) {
+    fprintf(stderr, "inn: print out of memory\n");
+    abort();
+  }
+  b->len = 0;
+  b->next = atomic_load(&inn_out_all);
+  while (!atomic_compare_exchange_weak(&inn_out_all, &b->next, b))
+    ;
+  if (!b->next) {
+    inn_out_tty = isatty(1);
+    atexit(inn_out_exit);
+  }
+  return inn_out = b;
+}
+
+// Room for `n` more bytes in this thread's buffer, which n has to fit.
+static inline char *inn_out_reserve(size_t n) {
+  inn_out_buf *b = inn_out ? inn_out : inn_out_new();
+  if (INN_OUT_SIZE - b->len < n)
+    inn_out_flush_buf(b);
+  char *p = b->data + b->len;
+  b->len += n;
+  return p;
+}
+
+static inline int inn_out_bytes(const char *p, long long n) {
+  if (n > INN_OUT_SIZE / 2) {
+    inn_out_flush_buf(inn_out ? inn_out : inn_out_new());
+    inn_out_write(p, n);
+  } else {
+    memcpy(inn_out_reserve(n), p, n);
+  }
+  return (int)n;
+}
+
+static inline int inn_out_cstr(const char *s) {
+  return inn_out_bytes(s, strlen(s));
+}
+
+static inline int inn_out_char(int c) {
+  *inn_out_reserve(1) = (char)c;
+  return 1;
+}
+
+static inline int inn_out_int(long long v) {
+  char tmp[24], *end = tmp + sizeof(tmp), *p = end;
+  unsigned long long u = v < 0 ? 0ull - (unsigned long long)v : v;
+  do {
+    *--p = '0' + u % 10;
+    u /= 10;
+  } while (u);
+  if (v < 0)
+    *--p = '-';
+  return inn_out_bytes(p, end - p);
+}
+
+static inline int inn_out_uint(unsigned long long u) {
+  char tmp[24], *end = tmp + sizeof(tmp), *p = end;
+  do {
+    *--p = '0' + u % 10;
+    u /= 10;
+  } while (u);
+  return inn_out_bytes(p, end - p);
+}
+
+static int inn_out_float_slow(double x, int prec) {
+  char tmp[400];
+  int n = snprintf(tmp, sizeof(tmp), "%.*f", prec, x);
+  return inn_out_bytes(tmp, n < (int)sizeof(tmp) ? n : (int)sizeof(tmp) - 1);
+}
+
+// Same digits as printf's %.*f. The fraction of a double of at least 2^-11
+// is a whole number of 2^-64ths, so it's scaled and rounded half to even
+// exactly in 128-bit integers. Anything else goes to snprintf.
+static int inn_out_float(double x, int prec) {
+#ifdef __SIZEOF_INT128__
+  static const unsigned long long pow10[] = {
+      1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+      1000000000};
+  double a = fabs(x);
+  if (!(a < 1e15) || (a != 0 && a < 0x1p-11) || prec < 0 || prec > 9)
+    return inn_out_float_slow(x, prec);
+  unsigned long long ip = (unsigned long long)a;
+  unsigned __int128 t =
+      (unsigned __int128)(unsigned long long)ldexp(a - ip, 64) * pow10[prec];
+  unsigned long long q = (unsigned long long)(t >> 64), r = (unsigned long long)t;
+  // Ties go to an even last digit, which is in `ip` for %.0f.
+  if (r > 1ull << 63 || (r == 1ull << 63 && ((prec ? q : ip) & 1)))
+    q++;
+  if (q >= pow10[prec]) {
+    q -= pow10[prec];
+    ip++;
+  }
+  char tmp[32], *p = tmp + sizeof(tmp);
+  for (int i = 0; i < prec; ++i, q /= 10)
+    *--p = '0' + q % 10;
+  if (prec > 0)
+    *--p = '.';
+  do {
+    *--p = '0' + ip % 10;
+    ip /= 10;
+  } while (ip);
+  if (signbit(x))
+    *--p = '-';
+  return inn_out_bytes(p, tmp + sizeof(tmp) - p);
+#else
+  return inn_out_float_slow(x, prec);
+#endif
+}
+
+// Called before stdio writes to stdout, which would otherwise overtake
+// buffered prints.
+static inline void inn_out_sync(void) {
+  if (inn_out && inn_out->len)
+    inn_out_flush_buf(inn_out);
+}
+
+// End of one print.
+static inline int inn_out_done(int n) {
+  if (inn_out_tty)
+    inn_out_sync();
+  return n;
+}
+
+static void inn_flush(void) {
+  inn_out_sync();
+  fflush(stdout);
+}
+
+#ifndef INN_PGO
+#pragma GCC pop_options
+#endif
+)";
+}
+
+std::string file_runtime() {
+  return R"(
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Scanning loops spend their time here, so it's optimized in -O0 builds too.
+#ifndef INN_PGO
+#pragma GCC push_options
+#pragma GCC optimize("O2")
+#endif
+
+static void inn_file_fail(const char *name) {
+  fprintf(stderr, "inn: cannot read %s\n", name);
+  exit(1);
+}
+
+// Regular files are mapped read-only and returned as a string viewing the
+// mapping, so slices of it, lines and fields copy nothing. Pipes and other
+// files without a size are read into memory instead.
+static inn_str inn_map_file(inn_str path) {
+  static _Thread_local inn_cstr_buf name_buf;
+  const char *name = inn_cstr(&name_buf, path);
+  int fd = open(name, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0)
+    inn_file_fail(name);
+  if (S_ISREG(st.st_mode) && st.st_size >= 16) {
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+      inn_file_fail(name);
+    madvise(p, st.st_size, MADV_SEQUENTIAL);
+    return inn_str_from(p, st.st_size, 0);
+  }
+  long long len = 0, cap = 4096;
+  char *buf = malloc(cap);
+  for (long long n = 1; buf && n > 0; len += n) {
+    if (len == cap)
+      buf = realloc(buf, cap *= 2);
+    n = buf ? read(fd, buf + len, cap - len) : -1;
+    if (n < 0)
+      inn_file_fail(name);
+  }
+  close(fd);
+  inn_str s = inn_str_from(buf, len, 0);
+  if (len < 16)
+    free(buf);
+  return s;
+}
+
+// Takes a string returned by map_file.
+static void inn_unmap_file(inn_str s) {
+  if (!inn_str_inline(s))
+    munmap((void *)s.p.ptr, inn_str_len(s));
+}
+
+// Position in a string, which it keeps a copy of so that short strings
+// stay valid too.
+typedef struct {
+  inn_str s;
+  long long at;
+} inn_scanner;
+
+static inline inn_scanner inn_scan(inn_str s) {
+  inn_scanner it = {s, 0};
+  return it;
+}
+
+static inline int inn_scan_done(inn_scanner *it) {
+  return it->at >= inn_str_len(it->s);
+}
+
+// Bytes up to the next `sep` or the end, skipping over the separator.
+static inline inn_str inn_scan_until(inn_scanner *it, int sep) {
+  long long len = inn_str_len(it->s);
+  if (it->at >= len)
+    return inn_str_from("", 0, 1);
+  const char *start = INN_STR_DATA(it->s) + it->at;
+  const char *found = memchr(start, sep, len - it->at);
+  long long n = found ? found - start : len - it->at;
+  it->at += n + (found != NULL);
+  return inn_str_from(start, n, 0);
+}
+
+static inline inn_str inn_next_line(inn_scanner *it) {
+  return inn_scan_until(it, '\n');
+}
+
+static inline inn_str inn_next_field(inn_scanner *it, inn_str sep) {
+  return inn_scan_until(it, (unsigned char)INN_STR_DATA(sep)[0]);
+}
+
+static inline int inn_parse_int(inn_str s) {
+  const char *p = INN_STR_DATA(s), *end = p + inn_str_len(s);
+  while (p < end && (*p == ' ' || *p == '\t'))
+    p++;
+  int neg = p < end && *p == '-';
+  p += p < end && (*p == '-' || *p == '+');
+  unsigned v = 0;
+  for (; p < end && *p >= '0' && *p <= '9'; p++)
+    v = v * 10 + (*p - '0');
+  return neg ? -(int)v : (int)v;
+}
+
+// Short decimals like "-12.75" are exact as a float mantissa over a power of
+// ten, and the single division rounds correctly. Anything else goes to strtof.
+static float inn_parse_float(inn_str s) {
+  static const float pow10[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f,
+                                1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+  const char *p = INN_STR_DATA(s), *end = p + inn_str_len(s);
+  while (p < end && (*p == ' ' || *p == '\t'))
+    p++;
+  int neg = p < end && *p == '-';
+  p += p < end && (*p == '-' || *p == '+');
+  unsigned long long m = 0;
+  int digits = 0, frac = -1;
+  for (; p < end && digits < 19; p++) {
+    if (*p >= '0' && *p <= '9') {
+      m = m * 10 + (*p - '0');
+      digits++;
+      frac += frac >= 0;
+    } else if (*p == '.' && frac < 0) {
+      frac = 0;
+    } else {
+      break;
+    }
+  }
+  if (frac < 0)
+    frac = 0;
+  if (digits > 0 && (p == end || *p == '\r') && m <= (1ull << 24) && frac <= 10) {
+    float v = (float)m / pow10[frac];
+    return neg ? -v : v;
+  }
+  char tmp[64];
+  long long len = inn_str_len(s);
+  if (len > 63)
+    len = 63;
+  memcpy(tmp, INN_STR_DATA(s), len);
+  tmp[len] = 0;
+  return strtof(tmp, NULL);
+}
+
+#ifndef INN_PGO
+#pragma GCC pop_options
+#endif
+)";
+}
+
+std::string map_runtime() {
+  return R"(
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Open addressing in the style of SwissTable. Each slot has a control byte
+// holding 7 bits of its key's hash, or marking it empty or deleted. Slots are
+// probed in groups of 16 whose control bytes are all compared with the hash
+// at once, so keys are only compared on likely matches. A probe ends at the
+// first group with an empty slot.
+#define INN_MAP_GROUP 16
+#define INN_MAP_EMPTY ((signed char)-128)
+#define INN_MAP_DELETED ((signed char)-2)
+
+// Bit i is set if control byte i of the group is `h`.
+static inline unsigned inn_map_match(const signed char *g, signed char h) {
+#ifdef __SSE2__
+  __m128i ctrl = _mm_load_si128((const __m128i *)g);
+  return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(h)));
+#else
+  unsigned m = 0;
+  for (int i = 0; i < INN_MAP_GROUP; ++i)
+    m |= (unsigned)(g[i] == h) << i;
+  return m;
+#endif
+}
+
+// Empty and deleted slots, the only control bytes with the top bit set.
+static inline unsigned inn_map_match_free(const signed char *g) {
+#ifdef __SSE2__
+  return (unsigned)_mm_movemask_epi8(_mm_load_si128((const __m128i *)g));
+#else
+  unsigned m = 0;
+  for (int i = 0; i < INN_MAP_GROUP; ++i)
+    m |= (unsigned)(g[i] < 0) << i;
+  return m;
+#endif
+}
+
+static inline unsigned long long inn_map_hash_int(unsigned long long x) {
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+static inline int inn_map_eq_int(long long a, long long b) { return a == b; }
+
+// First used slot at or after i, or cap if there's none.
+static inline long long inn_map_next(const signed char *ctrl, long long cap,
+                                     long long i) {
+  for (; i < cap; i = (i | (INN_MAP_GROUP - 1)) + 1) {
+    unsigned used = ~inn_map_match_free(ctrl + (i & -INN_MAP_GROUP)) & 0xffff;
+    used >>= i & (INN_MAP_GROUP - 1);
+    if (used)
+      return i + __builtin_ctz(used);
+  }
+  return cap;
+}
+
+// Control bytes and slots share one block, the slots cache line aligned.
+static inline long long inn_map_slots_at(long long cap) {
+  return (cap + 63) & ~63ll;
+}
+
+static inline signed char *inn_map_alloc(long long cap, size_t slot) {
+  size_t size = inn_map_slots_at(cap) + cap * slot;
+  signed char *ctrl = aligned_alloc(64, (size + 63) & ~(size_t)63);
+  if (!ctrl) {
+    fprintf(stderr, "inn: out of memory\n");
+    abort();
+  }
+  memset(ctrl, INN_MAP_EMPTY, cap);
+  return ctrl;
+}
+
+// Map types are declared before structs, which may hold maps, and their
+// operations after, since the values may be structs. `left` counts the
+// inserts into empty slots until the table is 7/8 full and has to grow.
+#define INN_MAP_TYPE(M)                                                        \
+  typedef struct M##_slot M##_slot;                                            \
+  typedef struct {                                                             \
+    signed char *ctrl;                                                         \
+    M##_slot *slots;                                                           \
+    long long cap, len, left;                                                  \
+  } M;
+
+#define INN_MAP_FUNCS(M, K, V, HASH, EQ)                                       \
+  struct M##_slot {                                                            \
+    K key;                                                                     \
+    V val;                                                                     \
+  };                                                                           \
+                                                                               \
+  static inline M##_slot *M##_lookup(const M *m, K key,                        \
+                                     unsigned long long h) {                   \
+    long long mask = m->cap / INN_MAP_GROUP - 1;                               \
+    long long g = (long long)(h >> 7) & mask;                                  \
+    for (long long step = 1;; g = (g + step++) & mask) {                       \
+      const signed char *ctrl = m->ctrl + g * INN_MAP_GROUP;                   \
+      unsigned hits = inn_map_match(ctrl, (signed char)(h & 0x7f));            \
+      for (; hits; hits &= hits - 1) {                                         \
+        M##_slot *s = m->slots + g * INN_MAP_GROUP + __builtin_ctz(hits);      \
+        if (EQ(s->key, key))                                                   \
+          return s;                                                            \
+      }                                                                        \
+      if (inn_map_match(ctrl, INN_MAP_EMPTY))                                  \
+        return NULL;                                                           \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static inline M##_slot *M##_find(const M *m, K key) {                        \
+    return m->len ? M##_lookup(m, key, HASH(key)) : NULL;                      \
+  }                                                                            \
+                                                                               \
+  /* Takes the first free slot on the probe for a key that isn't there. */    \
+  static inline M##_slot *M##_claim(M *m, unsigned long long h) {              \
+    long long mask = m->cap / INN_MAP_GROUP - 1;                               \
+    long long g = (long long)(h >> 7) & mask;                                  \
+    for (long long step = 1;; g = (g + step++) & mask) {                       \
+      unsigned avail = inn_map_match_free(m->ctrl + g * INN_MAP_GROUP);        \
+      if (avail) {                                                             \
+        long long i = g * INN_MAP_GROUP + __builtin_ctz(avail);                \
+        m->left -= m->ctrl[i] == INN_MAP_EMPTY;                                \
+        m->ctrl[i] = (signed char)(h & 0x7f);                                  \
+        m->len++;                                                              \
+        return m->slots + i;                                                   \
+      }                                                                        \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  /* Moves every entry into a new table, which drops deleted slots. */        \
+  static inline void M##_rehash(M *m, long long cap) {                         \
+    M old = *m;                                                                \
+    m->ctrl = inn_map_alloc(cap, sizeof(M##_slot));                            \
+    m->slots = (M##_slot *)(m->ctrl + inn_map_slots_at(cap));                  \
+    m->cap = cap;                                                              \
+    m->len = 0;                                                                \
+    m->left = cap - cap / 8;                                                   \
+    for (long long i = inn_map_next(old.ctrl, old.cap, 0); i < old.cap;        \
+         i = inn_map_next(old.ctrl, old.cap, i + 1))                           \
+      *M##_claim(m, HASH(old.slots[i].key)) = old.slots[i];                    \
+    free(old.ctrl);                                                            \
+  }                                                                            \
+                                                                               \
+  /* Room for n entries without growing. */                                   \
+  static inline void M##_reserve(M *m, long long n) {                          \
+    long long cap = INN_MAP_GROUP;                                             \
+    while (cap - cap / 8 < n)                                                  \
+      cap *= 2;                                                                \
+    if (cap > m->cap)                                                          \
+      M##_rehash(m, cap);                                                      \
+  }                                                                            \
+                                                                               \
+  /* Value slot for `key`, which is added with a zero value if it's new. */    \
+  static inline V *M##_put(M *m, K key) {                                      \
+    unsigned long long h = HASH(key);                                          \
+    M##_slot *s = m->len ? M##_lookup(m, key, h) : NULL;                       \
+    if (s)                                                                     \
+      return &s->val;                                                          \
+    /* Mostly deleted slots are cleaned up in place. */                        \
+    if (m->left == 0)                                                          \
+      M##_rehash(m, m->cap == 0                       ? INN_MAP_GROUP          \
+                    : m->len < (m->cap - m->cap / 8) / 2 ? m->cap              \
+                                                         : m->cap * 2);        \
+    s = M##_claim(m, h);                                                       \
+    s->key = key;                                                              \
+    memset(&s->val, 0, sizeof(V));                                             \
+    return &s->val;                                                            \
+  }                                                                            \
+                                                                               \
+  static inline V M##_get(const M *m, K key) {                                 \
+    M##_slot *s = M##_find(m, key);                                            \
+    V zero;                                                                    \
+    if (s)                                                                     \
+      return s->val;                                                           \
+    memset(&zero, 0, sizeof(V));                                               \
+    return zero;                                                               \
+  }                                                                            \
+                                                                               \
+  static inline int M##_has(const M *m, K key) {                               \
+    return M##_find(m, key) != NULL;                                           \
+  }                                                                            \
+                                                                               \
+  /* A slot can go back to empty if its group has another empty one, as no    \
+     probe passes through such a group. */                                     \
+  static inline int M##_del(M *m, K key) {                                     \
+    M##_slot *s = M##_find(m, key);                                            \
+    if (!s)                                                                    \
+      return 0;                                                                \
+    long long i = s - m->slots;                                                \
+    if (inn_map_match(m->ctrl + (i & -INN_MAP_GROUP), INN_MAP_EMPTY)) {        \
+      m->ctrl[i] = INN_MAP_EMPTY;                                              \
+      m->left++;                                                               \
+    } else {                                                                   \
+      m->ctrl[i] = INN_MAP_DELETED;                                            \
+    }                                                                          \
+    m->len--;                                                                  \
+    return 1;                                                                  \
+  }                                                                            \
+                                                                               \
+  static inline int M##_len(const M *m) { return (int)m->len; }                \
+                                                                               \
+  static inline void M##_clear(M *m) {                                         \
+    if (m->cap)                                                                \
+      memset(m->ctrl, INN_MAP_EMPTY, m->cap);                                  \
+    m->len = 0;                                                                \
+    m->left = m->cap - m->cap / 8;                                             \
+  }                                                                            \
+                                                                               \
+  static inline void M##_free(M *m) {                                          \
+    free(m->ctrl);                                                             \
+    memset(m, 0, sizeof(*m));                                                  \
+  }
+)";
+}
+
+// Results of a memo func taking one integer, for arguments from 0 up to
+// `limit`, in an array indexed by the argument. It grows to cover the
+// largest one seen. Needs the map module for its other arguments.
+std::string memo_runtime() {
+  return R"(
+#define INN_MEMO_DIRECT(M, V)                                                  \
+  typedef struct {                                                             \
+    V val;                                                                     \
+    char set;                                                                  \
+  } M##_entry;                                                                 \
+  typedef struct {                                                             \
+    M##_entry *at;                                                             \
+    long long cap;                                                             \
+  } M;                                                                         \
+                                                                               \
+  static inline M##_entry *M##_at(M *t, long long i, long long limit) {        \
+    if ((unsigned long long)i < (unsigned long long)t->cap)                    \
+      return t->at + i;                                                        \
+    if (i < 0 || i >= limit)                                                   \
+      return NULL;                                                             \
+    long long cap = t->cap ? t->cap * 2 : 64;                                  \
+    while (cap <= i)                                                           \
+      cap *= 2;                                                                \
+    if (cap > limit)                                                           \
+      cap = limit;                                                             \
+    M##_entry *at = (M##_entry *)realloc(t->at, cap * sizeof(M##_entry));      \
+    if (!at) {                                                                 \
+      fprintf(stderr, "inn: out of memory\n");                                 \
+      abort();                                                                 \
+    }                                                                          \
+    memset(at + t->cap, 0, (cap - t->cap) * sizeof(M##_entry));                \
+    t->at = at;                                                                \
+    t->cap = cap;                                                              \
+    return at + i;                                                             \
+  }
+)";
+}
+
+// Local arrays over the stack limit. Each pointer is declared with
+// __attribute__((cleanup(inn_heap_release))), so the array is freed however
+// its scope is left.
+std::string heap_runtime() {
+  return R"(
+static void *inn_heap_alloc(size_t size) {
+  void *p = calloc(1, size);
+  if (p == NULL) {
+    fprintf(stderr, "inn: out of memory for a %zu byte array\n", size);
+    exit(1);
+  }
+  return p;
+}
+
+static void inn_heap_release(void *p) { free(*(void **)p); }
+)";
+}
+
+std::string runtime_source(const std::string &module) {
+  if (module == "region")
+    return region_runtime();
+  if (module == "string")
+    return string_runtime();
+  if (module == "simd")
+    return simd_runtime();
+  if (module == "reduce")
+    return reduce_runtime();
+  if (module == "task")
+    return task_runtime();
+  if (module == "print")
+    return print_runtime();
+  if (module == "file")
+    return file_runtime();
+  if (module == "map")
+    return map_runtime();
+  if (module == "heap")
+    return heap_runtime();
+  if (module == "memo")
+    return memo_runtime();
+  throw std::runtime_error("Unknown runtime module: " + module);
+}
@@ -0,0 +1,256 @@
+#pragma once
+#include "ast.hpp"
+#include "codegen.hpp"
+#include "lexer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <poll.h>
+#include <sstream>
+#include <sys/inotify.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+// Watch mode keeps the AST of every top-level block between builds. A block
+// starts at a line beginning in the first column, other than `end` or a
+// comment, so unchanged blocks are found by their text and only edited ones
+// are lexed and parsed again.
+
+struct Block {
+  uint32_t offset; // Where the block starts, which positions in `roots` include
+  std::vector<Paragraph> roots;
+};
+
+void shift_positions(std::vector<Statement> &body, uint32_t delta);
+
+void shift_positions(Statement &stmt, uint32_t delta) {
+  stmt.pos.offset += delta;
+  if (auto loop = std::get_if<ASTWhile>(&stmt.value)) {
+    loop->pos.offset += delta;
+    shift_positions(loop->body, delta);
+  } else if (auto cond = std::get_if<ASTIf>(&stmt.value)) {
+    cond->pos.offset += delta;
+    for (auto &branch : cond->branches)
+      shift_positions(branch.second, delta);
+    shift_positions(cond->otherwise, delta);
+  } else if (auto ret = std::get_if<ASTReturn>(&stmt.value)) {
+    ret->pos.offset += delta;
+  } else if (auto yld = std::get_if<ASTYield>(&stmt.value)) {
+    yld->pos.offset += delta;
+  } else if (auto loop = std::get_if<ASTFor>(&stmt.value)) {
+    loop->pos.offset += delta;
+    shift_positions(loop->body, delta);
+  }
+}
+
+void shift_positions(std::vector<Statement> &body, uint32_t delta) {
+  for (auto &stmt : body)
+    shift_positions(stmt, delta);
+}
+
+// Moves a block which is unchanged but now starts somewhere else. Offsets
+// wrap around, so moving backwards works too.
+void shift_positions(Block &block, uint32_t offset) {
+  uint32_t delta = offset - block.offset;
+  block.offset = offset;
+  if (delta == 0)
+    return;
+  for (auto &para : block.roots) {
+    if (auto fdecl = std::get_if<ASTFuncDeclare>(&para)) {
+      fdecl->pos.offset += delta;
+      shift_positions(fdecl->body, delta);
+    } else if (auto sdecl = std::get_if<ASTStructDeclare>(&para)) {
+      sdecl->pos.offset += delta;
+    } else {
+      shift_positions(std::get<Statement>(para), delta);
+    }
+  }
+}
+
+std::vector<Paragraph> parse_source(std::string &&src, uint32_t offset = 0) {
+  Tokenizer tknizer(std::move(src));
+  tknizer.base = offset;
+  tknizer.tokenize();
+  ASTBuilder blder(std::move(tknizer.tokens));
+  blder.parse();
+  return std::move(blder.roots);
+}
+
+// Source text of each block, with the offset it starts at.
+std::vector<std::pair<std::string, uint32_t>>
+split_blocks(const std::string &src) {
+  std::vector<std::pair<std::string, uint32_t>> res{{"", 0}};
+  std::istringstream in(src);
+  std::string line;
+  for (uint32_t offset = 0; std::getline(in, line);
+       offset += line.size() + 1) {
+    bool starts = !line.empty() && !isspace(line[0]) && line[0] != '#' &&
+                  !(line.starts_with("end") &&
+                    (line.size() == 3 || !isalnum(line[3])));
+    if (starts && !res.back().first.empty())
+      res.emplace_back("", offset);
+    res.back().first += line + "\n";
+  }
+  return res;
+}
+
+struct Watcher {
+  std::string source, output;
+  std::function<std::string()> compile;
+  std::unordered_map<std::string, std::vector<Block>> blocks{};
+  std::string text{}; // Source of the last build, which positions point into
+
+  // Brings `blocks` up to date with `src`, returning how many blocks were
+  // parsed again. A block which doesn't parse on its own, for example
+  // because a function body isn't indented, falls back to the whole file.
+  size_t reparse(const std::string &src) {
+    std::unordered_map<std::string, std::vector<Block>> next{};
+    size_t parsed = 0;
+    auto parts = split_blocks(src);
+    try {
+      for (auto &[text, offset] : parts) {
+        auto &old = blocks[text];
+        if (!old.empty()) {
+          shift_positions(old.back(), offset);
+          next[text].push_back(std::move(old.back()));
+          old.pop_back();
+          continue;
+        }
+        next[text].push_back({offset, parse_source(std::string(text), offset)});
+        parsed++;
+      }
+    } catch (const std::exception &) {
+      // Blocks taken so far go back, so they survive a file that doesn't parse.
+      for (auto &[text, list] : next)
+        for (auto &block : list)
+          blocks[text].push_back(std::move(block));
+      next.clear();
+      next[src].push_back({0, parse_source(std::string(src))});
+      parsed = 1;
+    }
+    blocks = std::move(next);
+    return parsed;
+  }
+
+  // Code generation fills global tables, so it runs in a child process which
+  // leaves this one's AST and tables as they were.
+  void generate() {
+    pid_t pid = fork();
+    if (pid < 0) {
+      std::cerr << "fork failed" << std::endl;
+      return;
+    }
+    if (pid > 0) {
+      waitpid(pid, nullptr, 0);
+      return;
+    }
+    int status = 0;
+    try {
+      // Blocks are kept in source order so functions keep their order in C.
+      std::vector<std::pair<uint32_t, Block *>> order{};
+      for (auto &[text, list] : blocks)
+        for (auto &block : list)
+          order.emplace_back(block.offset, &block);
+      std::sort(order.begin(), order.end(),
+                [](auto &a, auto &b) { return a.first < b.first; });
+      std::vector<Paragraph> roots{};
+      for (auto &[offset, block] : order)
+        for (auto &para : block->roots)
+          roots.push_back(std::move(para));
+      auto start = std::chrono::steady_clock::now();
+      std::ofstream out(output + ".c");
+      out << generate_program(roots);
+      out.close();
+      if (codegen_options.shared)
+        std::ofstream(header_path(output)) << generate_header(roots);
+      auto generated = std::chrono::steady_clock::now();
+      status = system(compile().c_str()) == 0 ? 0 : 1;
+      auto compiled = std::chrono::steady_clock::now();
+      std::cerr << "C generated in " << milliseconds(generated - start)
+                << " ms, compiled in " << milliseconds(compiled - generated)
+                << " ms" << std::endl;
+    } catch (const SourceError &err) {
+      std::cerr << source_location(err.pos) << ": " << err.what()
+                << std::endl;
+      status = 1;
+    } catch (const std::exception &err) {
+      std::cerr << source << ": " << err.what() << std::endl;
+      status = 1;
+    }
+    _exit(status);
+  }
+
+  static double milliseconds(std::chrono::steady_clock::duration d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+  }
+
+  // `edited` builds report the latency from the save to their diagnostics.
+  void build(bool edited) {
+    auto start = std::chrono::steady_clock::now();
+    std::error_code ec;
+    auto written = std::filesystem::last_write_time(source, ec);
+    std::ifstream fstr(source);
+    std::ostringstream ss;
+    ss << fstr.rdbuf();
+    text = ss.str();
+    source_lines = LineTable(text);
+    try {
+      size_t parsed = reparse(text), total = 0;
+      for (auto &[text, list] : blocks)
+        total += list.size();
+      std::cerr << source << ": " << parsed << " of " << total
+                << " blocks parsed in "
+                << milliseconds(std::chrono::steady_clock::now() - start)
+                << " ms" << std::endl;
+      generate();
+    } catch (const SourceError &err) {
+      std::cerr << source_location(err.pos) << ": " << err.what()
+                << std::endl;
+    } catch (const std::exception &err) {
+      std::cerr << source << ": " << err.what() << std::endl;
+    }
+    // The write time is the closest thing to when the edit was made.
+    if (edited && !ec) {
+      auto latency = std::chrono::file_clock::now() - written;
+      std::cerr << source << ": done "
+                << std::chrono::duration<double, std::milli>(latency).count()
+                << " ms after save" << std::endl;
+    }
+  }
+
+  // Builds once, then again whenever the source is written. Editors often
+  // replace the file rather than write it, so the directory is watched.
+  int run() {
+    int fd = inotify_init1(IN_CLOEXEC);
+    std::filesystem::path path(source);
+    std::string dir = path.has_parent_path() ? path.parent_path().string() : ".";
+    if (fd < 0 ||
+        inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+      std::cerr << "Can't watch " << dir << std::endl;
+      return 1;
+    }
+    build(false);
+    alignas(inotify_event) char buf[4096];
+    while (true) {
+      bool changed = false;
+      // Saves come as several events, so wait until they stop.
+      pollfd pfd{fd, POLLIN, 0};
+      for (int timeout = -1; poll(&pfd, 1, timeout) > 0; timeout = 20) {
+        ssize_t len = read(fd, buf, sizeof(buf));
+        for (ssize_t i = 0; i < len;) {
+          auto event = reinterpret_cast<inotify_event *>(buf + i);
+          if (event->len != 0 && path.filename() == event->name)
+            changed = true;
+          i += sizeof(inotify_event) + event->len;
+        }
+      }
+      if (changed)
+        build(true);
+    }
+  }
+};